@@ -26,12 +26,37 @@ extern "C" object* lean_kernel_record_unfold (object*, object*);
 extern "C" object* lean_kernel_get_diag(object*);
 extern "C" object* lean_kernel_set_diag(object*, object*);
 extern "C" uint8* lean_kernel_diag_is_enabled(object*);
+extern "C" object* lean_kernel_record_def_eq_stat(object*, object*, object*, object*);
 
 void diagnostics::record_unfold(name const & decl_name) {
     m_obj = lean_kernel_record_unfold(to_obj_arg(), decl_name.to_obj_arg());
 }
 
-scoped_diagnostics::scoped_diagnostics(environment const & env, bool collect) {
+void diagnostics::record_def_eq_stats(name const & decl_name) {
+    auto record = [&](char const * counter, uint64 v) {
+        if (v > 0)
+            m_obj = lean_kernel_record_def_eq_stat(steal(), decl_name.to_obj_arg(), name(counter).to_obj_arg(), lean_uint64_to_nat(v));
+    };
+    def_eq_stats const & s = m_def_eq_stats;
+    record("is_def_eq",           s.m_is_def_eq);
+    record("quick",               s.m_quick);
+    record("eqv_cache_hit",       s.m_eqv_cache_hit);
+    record("failure_cache_hit",   s.m_failure_cache_hit);
+    record("failure_cached",      s.m_failure_cached);
+    record("proof_irrel",         s.m_proof_irrel);
+    record("offset",              s.m_offset);
+    record("lazy_delta",          s.m_lazy_delta);
+    record("lazy_delta_step",     s.m_lazy_delta_step);
+    record("eta_struct",          s.m_eta_struct);
+    record("whnf_core",           s.m_whnf_core);
+    record("whnf_core_cache_hit", s.m_whnf_core_cache_hit);
+    record("is_def_eq_time_us",   s.m_is_def_eq_us);
+    record("lazy_delta_time_us",  s.m_lazy_delta_us);
+    m_def_eq_stats = def_eq_stats();
+}
+
+scoped_diagnostics::scoped_diagnostics(environment const & env, bool collect, name const & decl_name):
+    m_decl_name(decl_name) {
     if (collect) {
         diagnostics d(env.get_diag());
         if (lean_kernel_diag_is_enabled(d.to_obj_arg())) {
@@ -49,9 +74,10 @@ scoped_diagnostics::~scoped_diagnostics() {
 }
 
 environment scoped_diagnostics::update(environment const & env) const {
-    if (m_diag)
+    if (m_diag) {
+        m_diag->record_def_eq_stats(m_decl_name);
         return env.set_diag(*m_diag);
-    else
+    } else
         return env;
 }
 
@@ -150,16 +176,16 @@ environment environment::add(constant_info const & info) const {
 }
 
 environment environment::add_axiom(declaration const & d, bool check) const {
-    scoped_diagnostics diag(*this, check);
     axiom_val const & v = d.to_axiom_val();
+    scoped_diagnostics diag(*this, check, v.get_name());
     if (check)
         check_constant_val(*this, v.to_constant_val(), diag.get(), !d.is_unsafe());
     return diag.update(add(constant_info(d)));
 }
 
 environment environment::add_definition(declaration const & d, bool check) const {
-    scoped_diagnostics diag(*this, check);
     definition_val const & v = d.to_definition_val();
+    scoped_diagnostics diag(*this, check, v.get_name());
     if (v.is_unsafe()) {
         /* Meta definition can be recursive.
            So, we check the header, add, and then type check the body. */
@@ -190,8 +216,8 @@ environment environment::add_definition(declaration const & d, bool check) const
 }
 
 environment environment::add_theorem(declaration const & d, bool check) const {
-    scoped_diagnostics diag(*this, check);
     theorem_val const & v = d.to_theorem_val();
+    scoped_diagnostics diag(*this, check, v.get_name());
     if (check) {
         type_checker checker(*this, diag.get());
         sharecommon_persistent_fn share;
@@ -209,8 +235,8 @@ environment environment::add_theorem(declaration const & d, bool check) const {
 }
 
 environment environment::add_opaque(declaration const & d, bool check) const {
-    scoped_diagnostics diag(*this, check);
     opaque_val const & v = d.to_opaque_val();
+    scoped_diagnostics diag(*this, check, v.get_name());
     if (check) {
         type_checker checker(*this, diag.get());
         check_constant_val(*this, v.to_constant_val(), checker);
@@ -222,10 +248,10 @@ environment environment::add_opaque(declaration const & d, bool check) const {
 }
 
 environment environment::add_mutual(declaration const & d, bool check) const {
-    scoped_diagnostics diag(*this, check);
     definition_vals const & vs = d.to_definition_vals();
     if (empty(vs))
         throw kernel_exception(*this, "invalid empty mutual definition");
+    scoped_diagnostics diag(*this, check, head(vs).get_name());
     definition_safety safety = head(vs).get_safety();
     if (safety == definition_safety::safe)
         throw kernel_exception(*this, "invalid mutual definition, declaration is not tagged as unsafe/partial");
@@ -25,15 +25,41 @@ Author: Leonardo de Moura
 
 namespace theorem_ai {
 
+/*
+Counters of the definitional equality checker of the kernel (`type_checker::is_def_eq`), collected
+while checking a declaration with diagnostics enabled. They are stored in
+`Kernel.Diagnostics.defEqStats` by `diagnostics::record_def_eq_stats`.
+*/
+struct def_eq_stats {
+    uint64 m_is_def_eq         = 0; // calls to `is_def_eq_core`
+    uint64 m_quick             = 0; // calls decided by `quick_is_def_eq`
+    uint64 m_eqv_cache_hit     = 0; // calls decided by the `equiv_manager`
+    uint64 m_failure_cache_hit = 0;
+    uint64 m_failure_cached    = 0;
+    uint64 m_proof_irrel       = 0; // calls decided by proof irrelevance
+    uint64 m_offset            = 0; // calls decided by `is_def_eq_offset`
+    uint64 m_lazy_delta        = 0; // calls to `lazy_delta_reduction`
+    uint64 m_lazy_delta_step   = 0;
+    uint64 m_eta_struct        = 0; // calls decided by structure eta
+    uint64 m_whnf_core         = 0;
+    uint64 m_whnf_core_cache_hit = 0;
+    uint64 m_is_def_eq_us      = 0; // time spent in outermost calls to `is_def_eq_core`
+    uint64 m_lazy_delta_us     = 0; // time spent in outermost calls to `lazy_delta_reduction`
+};
+
 /* Wrapper for `Kernel.Diagnostics` */
 class diagnostics : public object_ref {
+    def_eq_stats m_def_eq_stats;
 public:
-    diagnostics(diagnostics const & other):object_ref(other) {}
-    diagnostics(diagnostics && other):object_ref(std::move(other)) {}
+    diagnostics(diagnostics const & other):object_ref(other), m_def_eq_stats(other.m_def_eq_stats) {}
+    diagnostics(diagnostics && other):object_ref(std::move(other)), m_def_eq_stats(other.m_def_eq_stats) {}
     explicit diagnostics(b_obj_arg o, bool b):object_ref(o, b) {}
     explicit diagnostics(obj_arg o):object_ref(o) {}
     ~diagnostics() {}
     void record_unfold(name const & decl_name);
+    def_eq_stats & get_def_eq_stats() { return m_def_eq_stats; }
+    /* Store the counters of `get_def_eq_stats()` as the ones of `decl_name`, and reset them. */
+    void record_def_eq_stats(name const & decl_name);
 };
 
 /*
@@ -46,8 +72,10 @@ that was not requested.
 */
 class scoped_diagnostics {
     diagnostics * m_diag;
+    name          m_decl_name;
 public:
-    scoped_diagnostics(environment const & env, bool collect);
+    /* `decl_name` is the name under which the statistics of the definitional equality checker are stored. */
+    scoped_diagnostics(environment const & env, bool collect, name const & decl_name);
     scoped_diagnostics(scoped_diagnostics const &) = delete;
     scoped_diagnostics(scoped_diagnostics &&) = delete;
     ~scoped_diagnostics();
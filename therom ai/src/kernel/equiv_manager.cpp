@@ -4,16 +4,33 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <atomic>
 #include "runtime/interrupt.h"
 #include "runtime/flet.h"
+#include "runtime/thread.h"
+#include "runtime/compact.h"
 #include "kernel/equiv_manager.h"
+#include "kernel/for_each_fn.h"
 
 namespace theorem_ai {
-auto equiv_manager::mk_node() -> node_ref {
+/* Number of times compacted regions have been freed. */
+static std::atomic<unsigned> g_generation(0);
+/* Number of term objects retained by the persistent managers of all threads. */
+static std::atomic<size_t> g_num_retained(0);
+/* Number of times `g_num_retained` has exceeded the bound; each increment asks all threads to clear their
+   persistent managers. */
+static std::atomic<unsigned> g_release_epoch(0);
+
+equiv_manager::equiv_manager():
+    m_use_hash(false), m_structural(true), m_generation(g_generation.load(std::memory_order_relaxed)),
+    m_release_epoch(g_release_epoch.load(std::memory_order_relaxed)) {}
+
+auto equiv_manager::mk_node(expr const & e) -> node_ref {
     node_ref r = m_nodes.size();
     node n;
     n.m_parent = r;
     n.m_rank   = 0;
+    n.m_expr   = e;
     m_nodes.push_back(n);
     return r;
 }
@@ -23,7 +40,10 @@ auto equiv_manager::find(node_ref n) -> node_ref {
         node_ref p = m_nodes[n].m_parent;
         if (p == n)
             return p;
-        n = p;
+        // path halving: make `n` point to its grandparent
+        node_ref g = m_nodes[p].m_parent;
+        m_nodes[n].m_parent = g;
+        n = g;
     }
 }
 
@@ -45,26 +65,133 @@ void equiv_manager::merge(node_ref n1, node_ref n2) {
 }
 
 auto equiv_manager::to_node(expr const & e) -> node_ref {
-    auto it = m_to_node.find(e);
-    if (it != m_to_node.end())
-        return it->second;
-    node_ref r = mk_node();
-    m_to_node.insert(mk_pair(e, r));
+    if (node_ref * r = m_to_node.find(e.raw()))
+        return *r;
+    node_ref r = mk_node(e);
+    m_to_node.insert(e.raw(), r);
     return r;
 }
 
+bool equiv_manager::is_known_equiv(expr const & a, expr const & b) {
+    node_ref * n1 = m_to_node.find(a.raw());
+    if (!n1)
+        return false;
+    node_ref * n2 = m_to_node.find(b.raw());
+    return n2 && find(*n1) == find(*n2);
+}
+
+#ifndef LEAN_EQUIV_MANAGER_MAX_PERSISTENT_TERMS
+#define LEAN_EQUIV_MANAGER_MAX_PERSISTENT_TERMS (1u << 20)
+#endif
+
+LEAN_THREAD_PTR(equiv_manager, g_persistent);
+
+void equiv_manager::finalize_persistent(void * p) {
+    equiv_manager * m = reinterpret_cast<equiv_manager *>(p);
+    m->drop_stale();
+    m->clear();
+    delete m;
+    g_persistent = nullptr;
+}
+
+equiv_manager & equiv_manager::get_persistent() {
+    if (!g_persistent) {
+        g_persistent = new equiv_manager();
+        register_thread_finalizer(finalize_persistent, g_persistent);
+    }
+    g_persistent->drop_stale();
+    return *g_persistent;
+}
+
+/* If compacted regions have been freed since the entries were added, the retained terms may point into
+   unmapped memory, and their addresses may be reused by objects of regions loaded later. The entries are
+   removed without decrementing the reference counts of the terms, which would traverse them: their
+   memory is leaked. This only happens for threads other than the one freeing the regions. */
+void equiv_manager::drop_stale() {
+    unsigned g = g_generation.load(std::memory_order_acquire);
+    if (m_generation == g)
+        return;
+    for (node & n : m_nodes)
+        n.m_expr.steal();
+    clear();
+    m_generation = g;
+}
+
+/* Called before a compacted region is freed: the entries of the current thread can still be released. */
+void equiv_manager::clear_persistent_before_free(void const *, void const *) {
+    unsigned g = g_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if (g_persistent) {
+        g_persistent->clear();
+        g_persistent->m_generation = g;
+    }
+}
+
+void equiv_manager::clear() {
+    if (m_retained.size() > 0)
+        g_num_retained.fetch_sub(m_retained.size(), std::memory_order_relaxed);
+    m_nodes.clear();
+    m_to_node.clear();
+    m_retained.clear();
+}
+
+void equiv_manager::bound_persistent() {
+    equiv_manager & p = get_persistent();
+    unsigned e = g_release_epoch.load(std::memory_order_relaxed);
+    if (p.m_release_epoch != e) {
+        p.clear();
+        p.m_release_epoch = e;
+    }
+}
+
+void equiv_manager::clear_persistent() {
+    if (g_persistent)
+        g_persistent->clear();
+}
+
+void equiv_manager::add_persistent_equiv(expr const & a, expr const & b) {
+    if (lean_is_persistent(a.raw()) || lean_is_persistent(b.raw()))
+        return;
+    auto retain = [&](expr const & e) {
+        for_each(e, [&](expr const & s) {
+                return !lean_is_persistent(s.raw()) && m_retained.insert(s.raw());
+            });
+    };
+    size_t before = m_retained.size();
+    retain(a);
+    retain(b);
+    size_t added = m_retained.size() - before;
+    if (g_num_retained.fetch_add(added, std::memory_order_relaxed) + added > LEAN_EQUIV_MANAGER_MAX_PERSISTENT_TERMS) {
+        // ask every thread to release its entries, starting with this one
+        m_release_epoch = g_release_epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+        clear();
+        return;
+    }
+    add_equiv(a, b);
+}
+
 bool equiv_manager::is_equiv_core(expr const & a, expr const & b) {
     if (is_eqp(a, b))                      return true;
-    if (m_use_hash && hash(a) != hash(b))  return false;
+    if (m_use_hash && get_data(a) != get_data(b)) return false;
     if (is_bvar(a) && is_bvar(b))          return bvar_idx(a) == bvar_idx(b);
     node_ref r1 = find(to_node(a));
     node_ref r2 = find(to_node(b));
-    if (r1 == r2)
+    equiv_manager & persistent = get_persistent();
+    if (r1 == r2) {
+        // the equality may come from `add_equiv`, unless it is also known to `persistent`
+        if (m_structural && !persistent.is_known_equiv(a, b))
+            m_structural = false;
         return true;
+    }
+    if (persistent.is_known_equiv(a, b)) {
+        merge(r1, r2);
+        return true;
+    }
     // fall back to structural equality
     if (a.kind() != b.kind())
         return false;
     check_system("expression equivalence test");
+    bool structural = m_structural;
+    m_structural = true;
     bool result = false;
     switch (a.kind()) {
     case expr_kind::BVar:
@@ -109,13 +236,18 @@ bool equiv_manager::is_equiv_core(expr const & a, expr const & b) {
             is_equiv_core(let_body(a), let_body(b));
         break;
     }
-    if (result)
+    if (result) {
         merge(r1, r2);
+        if (m_structural)
+            persistent.add_persistent_equiv(a, b);
+    }
+    m_structural = structural && m_structural;
     return result;
 }
 
 bool equiv_manager::is_equiv(expr const & a, expr const & b, bool use_hash) {
     flet<bool> set(m_use_hash, use_hash);
+    m_structural = true;
     return is_equiv_core(a, b);
 }
 
@@ -124,4 +256,11 @@ void equiv_manager::add_equiv(expr const & e1, expr const & e2) {
     node_ref r2 = to_node(e2);
     merge(r1, r2);
 }
+
+void initialize_equiv_manager() {
+    register_compacted_region_free_hook(equiv_manager::clear_persistent_before_free);
+}
+
+void finalize_equiv_manager() {
+}
 }
@@ -6,29 +6,71 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <vector>
-#include "kernel/expr_maps.h"
+#include "util/ptr_map.h"
+#include "kernel/expr.h"
 
 namespace theorem_ai {
+/* Union-find over terms, keyed by their pointers. Each type checker state has its own `equiv_manager`,
+   which records both structural equalities and the definitional equalities established by the type checker.
+
+   In addition, the structural equalities found by `is_equiv` are recorded in a per-thread `equiv_manager`
+   that persists across type checkers, so that checking the same large terms for several declarations
+   is not redone every time. Structural equality does not depend on the environment or the local context,
+   so these entries are valid for any declaration of the same import session. Objects of compacted regions
+   (with reference count 0) are not kept alive by their nodes, so they are never added to it, and it is
+   dropped when compacted regions are freed, since the terms it retains may still point into them.
+
+   The number of terms retained by the persistent managers of all threads is bounded by
+   `LEAN_EQUIV_MANAGER_MAX_PERSISTENT_TERMS`, checked when entries are added. When the bound is exceeded,
+   every thread clears its manager the next time it uses it. Threads that check declarations on behalf of
+   another one clear theirs when done, with `clear_persistent`. */
 class equiv_manager {
     typedef unsigned node_ref;
 
     struct node {
         node_ref m_parent;
         unsigned m_rank;
+        expr     m_expr; // keeps the key of the node alive
     };
 
-    std::vector<node>  m_nodes;
-    expr_map<node_ref> m_to_node;
-    bool               m_use_hash;
+    std::vector<node>                  m_nodes;
+    ptr_map<lean_object *, node_ref>   m_to_node;
+    bool                               m_use_hash;
+    /* Set to false when `is_equiv_core` concludes from an equality that may not be structural. */
+    bool                               m_structural;
+    /* Persistent manager only: the term objects kept alive by the nodes, for bounding the memory it retains,
+       the value of the counter of freed compacted regions when its entries were added, and the value of
+       the counter of release requests when it was last cleared. */
+    ptr_set<lean_object *>             m_retained;
+    unsigned                           m_generation;
+    unsigned                           m_release_epoch;
 
-    node_ref mk_node();
+    node_ref mk_node(expr const & e);
     node_ref find(node_ref n);
     void merge(node_ref n1, node_ref n2);
     node_ref to_node(expr const & e);
     bool is_equiv_core(expr const & e1, expr const & e2);
+    /* Return true iff `e1` and `e2` are already known to be in the same class; does not create nodes. */
+    bool is_known_equiv(expr const & e1, expr const & e2);
+    void add_persistent_equiv(expr const & e1, expr const & e2);
+    void drop_stale();
+    static equiv_manager & get_persistent();
+    static void finalize_persistent(void * p);
+    static void clear_persistent_before_free(void const * begin, void const * end);
+    friend void initialize_equiv_manager();
 public:
-    equiv_manager():m_use_hash(false) {}
+    equiv_manager();
     bool is_equiv(expr const & e1, expr const & e2, bool use_hash = false);
     void add_equiv(expr const & e1, expr const & e2);
+    size_t size() const { return m_nodes.size(); }
+    void clear();
+    /* Clear the persistent `equiv_manager` of the current thread if the terms kept alive by the persistent
+       managers have grown too large. It is called between declarations. */
+    static void bound_persistent();
+    /* Clear the persistent `equiv_manager` of the current thread, if any. */
+    static void clear_persistent();
 };
+
+void initialize_equiv_manager();
+void finalize_equiv_manager();
 }
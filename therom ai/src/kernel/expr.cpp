@@ -13,9 +13,11 @@ Author: Leonardo de Moura
 #include "runtime/hash.h"
 #include "runtime/buffer.h"
 #include "util/list_fn.h"
+#include "util/ptr_map.h"
 #include "kernel/expr.h"
 #include "kernel/expr_eq_fn.h"
 #include "kernel/expr_sets.h"
+#include "kernel/expr_size.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/replace_fn.h"
 #include "kernel/abstract.h"
@@ -390,7 +392,7 @@ bool has_loose_bvar(expr const & e, unsigned i) {
     if (!has_loose_bvars(e))
         return false;
     bool found = false;
-    for_each(e, [&](expr const & e, unsigned offset) {
+    for_each_offset(e, [&](expr const & e, unsigned offset) {
             if (found)
                 return false; // already found
             unsigned n_i = i + offset;
@@ -418,7 +420,7 @@ expr lower_loose_bvars(expr const & e, unsigned s, unsigned d) {
     if (d == 0 || s >= get_loose_bvar_range(e))
         return e;
     lean_assert(s >= d);
-    return replace(e, [=](expr const & e, unsigned offset) -> optional<expr> {
+    return replace_rec(e, [=](expr const & e, unsigned offset) -> optional<expr> {
             unsigned s1 = s + offset;
             if (s1 < s)
                 return some_expr(e); // overflow, vidx can't be >= max unsigned
@@ -448,7 +450,7 @@ extern "C" LEAN_EXPORT object * lean_expr_lower_loose_bvars(b_obj_arg e, b_obj_a
 expr lift_loose_bvars(expr const & e, unsigned s, unsigned d) {
     if (d == 0 || s >= get_loose_bvar_range(e))
         return e;
-    return replace(e, [=](expr const & e, unsigned offset) -> optional<expr> {
+    return replace_rec(e, [=](expr const & e, unsigned offset) -> optional<expr> {
             unsigned s1 = s + offset;
             if (s1 < s)
                 return some_expr(e); // overflow, vidx can't be >= max unsigned
@@ -521,6 +523,62 @@ void finalize_expr() {
     delete g_default_name;
 }
 
+// =======================================
+// Size
+
+/* Tree sizes of the compound subterms visited by `get_tree_size`, memoized by pointer. The `Expr.Data` word of a
+   term has no room left for its size. */
+class expr_size_fn {
+    ptr_map<lean_object *, unsigned> m_cache;
+    unsigned                         m_max;
+public:
+    explicit expr_size_fn(unsigned max):m_max(max) {}
+
+    unsigned operator()(expr const & e) {
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::Sort:
+        case expr_kind::BVar:  case expr_kind::Lit:
+        case expr_kind::MVar:  case expr_kind::FVar:
+            return 1;
+        default:
+            break;
+        }
+        if (unsigned const * r = m_cache.find(e.raw()))
+            return *r;
+        uint64 r = 1;
+        auto add = [&](expr const & c) { if (r < m_max) r += (*this)(c); };
+        switch (e.kind()) {
+        case expr_kind::MData:  add(mdata_expr(e)); break;
+        case expr_kind::Proj:   add(proj_expr(e)); break;
+        case expr_kind::App:    add(app_fn(e)); add(app_arg(e)); break;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            add(binding_domain(e)); add(binding_body(e)); break;
+        case expr_kind::Let:
+            add(let_type(e)); add(let_value(e)); add(let_body(e)); break;
+        default:
+            lean_unreachable();
+        }
+        unsigned s = static_cast<unsigned>(std::min(r, static_cast<uint64>(m_max)));
+        m_cache.insert(e.raw(), s);
+        return s;
+    }
+};
+
+unsigned get_tree_size(expr const & e, unsigned max) {
+    return expr_size_fn(max)(e);
+}
+
+unsigned get_dag_size(expr const & e) {
+    // `for_each` applies its callback to every occurrence of atoms and unshared nodes, so we keep our own set
+    ptr_set<lean_object *> visited;
+    for_each(e, [&](expr const & s) { return visited.insert(s.raw()); });
+    return visited.size();
+}
+
+extern "C" LEAN_EXPORT uint32 lean_expr_tree_size(b_obj_arg e, uint32 max) {
+    return get_tree_size(TO_REF(expr, e), max);
+}
+
 // =======================================
 // Legacy
 
@@ -157,9 +157,24 @@ inline bool has_fvar(expr const & e) {
 bool has_univ_param(expr const & e);
 unsigned get_loose_bvar_range(expr const & e);
 
-struct expr_hash { unsigned operator()(expr const & e) const { return hash(e); } };
+/* Wide hash of `e` for the hash tables of the kernel, mixing the whole `Expr.Data` word instead of only its
+   32-bit hash: the approximate depth, the loose bound variable range and the flags are also determined by the
+   structure of `e`, so structurally equal terms have the same wide hash, while terms whose 32-bit hashes collide
+   are often told apart. The mixing function (the finalizer of MurmurHash3) is a bijection, and spreads the fields
+   over all bits, including the low ones used to select buckets. */
+inline uint64 hash64(expr const & e) {
+    uint64 h = get_data(e);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+struct expr_hash { size_t operator()(expr const & e) const { return static_cast<size_t>(hash64(e)); } };
 struct expr_pair_hash {
-    unsigned operator()(expr_pair const & p) const { return hash(hash(p.first), hash(p.second)); }
+    size_t operator()(expr_pair const & p) const { return static_cast<size_t>(hash(hash64(p.first), hash64(p.second))); }
 };
 struct expr_pair_eq {
     bool operator()(expr_pair const & p1, expr_pair const & p2) const { return p1.first == p2.first && p1.second == p2.second; }
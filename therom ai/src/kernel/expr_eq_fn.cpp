@@ -53,7 +53,8 @@ class expr_eq_fn {
     }
     bool apply(expr const & a, expr const & b, unsigned depth, bool root = false) {
         if (is_eqp(a, b))          return true;
-        if (hash(a) != hash(b))    return false;
+        // the data words contain the hash, depth, loose bound variable range and flags, which equal terms share
+        if (get_data(a) != get_data(b)) return false;
         if (a.kind() != b.kind())  return false;
         switch (a.kind()) {
         case expr_kind::BVar: return bvar_idx(a) == bvar_idx(b);
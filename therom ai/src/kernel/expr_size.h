@@ -0,0 +1,15 @@
+/*
+Copyright (c) 2025 theorem_ai FRO. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include "kernel/expr.h"
+
+namespace theorem_ai {
+/* Return the tree size of `e`, i.e., the number of nodes counting a shared subterm once per occurrence,
+   saturating at `max`. The size is not cached in `e`: this traverses `e`, visiting each distinct subterm once. */
+unsigned get_tree_size(expr const & e, unsigned max);
+
+/* Return the number of distinct subterms of `e` (its size as a DAG, up to pointer equality). */
+unsigned get_dag_size(expr const & e);
+}
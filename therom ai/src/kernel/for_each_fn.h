@@ -11,6 +11,7 @@ Author: Leonardo de Moura
 #include "runtime/buffer.h"
 #include "kernel/expr.h"
 #include "kernel/expr_sets.h"
+#include "util/ptr_map.h"
 
 namespace theorem_ai {
 /**
@@ -27,4 +28,141 @@ The \c offset is the number of binders under which \c e occurs.
 void for_each(expr const & e, std::function<bool(expr const &, unsigned)> && f); // NOLINT
 
 void for_each(expr const & e, std::function<bool(expr const &)> && f); // NOLINT
+
+/*
+If `partial_apps = true`, then given a term `g a b`, we also apply the function `m_f` to `g a`,
+and not only to `g`, `a`, and `b`.
+*/
+template<typename F, bool partial_apps = true> class for_each_fn {
+    ptr_set<lean_object *> m_cache;
+    F const &              m_f;
+
+    bool visited(expr const & e) {
+        if (is_likely_unshared(e)) return false;
+        return !m_cache.insert(e.raw());
+    }
+
+    void apply_fn(expr const & e) {
+        if (is_app(e)) {
+            apply_fn(app_fn(e));
+            apply(app_arg(e));
+        } else {
+            apply(e);
+        }
+    }
+
+    void apply(expr const & e) {
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::BVar: case expr_kind::Sort:
+            m_f(e);
+            return;
+        default:
+            break;
+        }
+
+        if (visited(e))
+            return;
+
+        if (!m_f(e))
+            return;
+
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::BVar:
+        case expr_kind::Sort:  case expr_kind::Lit:
+        case expr_kind::MVar:  case expr_kind::FVar:
+            return;
+        case expr_kind::MData:
+            apply(mdata_expr(e));
+            return;
+        case expr_kind::Proj:
+            apply(proj_expr(e));
+            return;
+        case expr_kind::App:
+            if (partial_apps)
+                apply(app_fn(e));
+            else
+                apply_fn(app_fn(e));
+            apply(app_arg(e));
+            return;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            apply(binding_domain(e));
+            apply(binding_body(e));
+            return;
+        case expr_kind::Let:
+            apply(let_type(e));
+            apply(let_value(e));
+            apply(let_body(e));
+            return;
+        }
+    }
+
+public:
+    for_each_fn(F const & f):m_f(f) {}
+    void operator()(expr const & e) { apply(e); }
+};
+
+template<typename F> class for_each_offset_fn {
+    ptr_set<std::pair<lean_object *, unsigned>> m_cache;
+    F const &                                   m_f;
+
+    bool visited(expr const & e, unsigned offset) {
+        if (is_likely_unshared(e)) return false;
+        return !m_cache.insert(std::make_pair(e.raw(), offset));
+    }
+
+    void apply(expr const & e, unsigned offset) {
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::BVar: case expr_kind::Sort:
+            m_f(e, offset);
+            return;
+        default:
+            break;
+        }
+
+        if (visited(e, offset))
+            return;
+
+        if (!m_f(e, offset))
+            return;
+
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::BVar:
+        case expr_kind::Sort:  case expr_kind::Lit:
+        case expr_kind::MVar:  case expr_kind::FVar:
+            return;
+        case expr_kind::MData:
+            apply(mdata_expr(e), offset);
+            return;
+        case expr_kind::Proj:
+            apply(proj_expr(e), offset);
+            return;
+        case expr_kind::App:
+            apply(app_fn(e), offset);
+            apply(app_arg(e), offset);
+            return;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            apply(binding_domain(e), offset);
+            apply(binding_body(e), offset+1);
+            return;
+        case expr_kind::Let:
+            apply(let_type(e), offset);
+            apply(let_value(e), offset);
+            apply(let_body(e), offset+1);
+            return;
+        }
+    }
+
+public:
+    for_each_offset_fn(F const & f):m_f(f) {}
+    void operator()(expr const & e) { apply(e, 0); }
+};
+
+/**
+\brief Like `for_each` with an offset, but `f` can be any function object `bool(expr const &, unsigned)`.
+The traversal is instantiated for the type of `f`, which avoids an indirect call per visited subterm.
+*/
+template<typename F> void for_each_offset(expr const & e, F const & f) {
+    for_each_offset_fn<F> fn(f);
+    fn(e);
+}
 }
@@ -4,11 +4,19 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
 #include "runtime/sstream.h"
 #include "runtime/utf8.h"
+#include "runtime/thread.h"
+#include "runtime/interrupt.h"
 #include "util/name_generator.h"
 #include "kernel/environment.h"
 #include "kernel/type_checker.h"
+#include "kernel/equiv_manager.h"
+#include "kernel/expr_maps.h"
 #include "kernel/instantiate.h"
 #include "kernel/abstract.h"
 #include "kernel/find_fn.h"
@@ -120,6 +128,24 @@ optional<recursor_rule> get_rec_rule_for(recursor_val const & rec_val, expr cons
     return optional<recursor_rule>();
 }
 
+/* Minimal number of constructors of a declaration for checking them, and creating their minor premises and
+   recursor rules, in parallel tasks. */
+static constexpr unsigned g_par_min_cnstrs = 64;
+
+class add_inductive_fn;
+
+/* Work items of `add_inductive_fn::par_map`, split into chunks. Each chunk is processed by a task using its own copy
+   of the `add_inductive_fn` object, with the heartbeats, heartbeat limit, and cancel token of the thread that created
+   the job, so that the type checkers of the tasks are interrupted like the ones of that thread. */
+struct par_cnstr_job {
+    std::function<expr(add_inductive_fn &, unsigned)> m_fn;
+    std::vector<std::unique_ptr<add_inductive_fn>>   m_workers; // one per chunk
+    std::vector<unsigned>                            m_chunk_begin;
+    std::vector<expr>                                m_results;
+    std::vector<std::exception_ptr>                  m_errors;  // per chunk
+    interrupt_state                                  m_interrupt;
+};
+
 /* Auxiliary class for adding a mutual inductive datatype declaration. */
 class add_inductive_fn {
     environment            m_env;
@@ -170,6 +196,91 @@ public:
 
     type_checker tc() { return type_checker(m_env, m_lctx, m_diag, m_is_unsafe ? definition_safety::unsafe : definition_safety::safe); }
 
+    /* Mark the objects referenced by this object as multi-threaded, before sharing them with tasks. */
+    void mark_mt() {
+        theorem_ai::mark_mt(m_env.raw());
+        theorem_ai::mark_mt(m_lctx.raw());
+        theorem_ai::mark_mt(m_lparams.raw());
+        theorem_ai::mark_mt(m_result_level.raw());
+        theorem_ai::mark_mt(m_levels.raw());
+        theorem_ai::mark_mt(m_elim_level.raw());
+        for (inductive_type const & ind_type : m_ind_types) theorem_ai::mark_mt(ind_type.raw());
+        for (expr const & e : m_params) theorem_ai::mark_mt(e.raw());
+        for (expr const & e : m_ind_cnsts) theorem_ai::mark_mt(e.raw());
+        for (rec_info const & info : m_rec_infos) {
+            theorem_ai::mark_mt(info.m_C.raw());
+            theorem_ai::mark_mt(info.m_major.raw());
+            for (expr const & e : info.m_minors) theorem_ai::mark_mt(e.raw());
+            for (expr const & e : info.m_indices) theorem_ai::mark_mt(e.raw());
+        }
+    }
+
+    static obj_res par_cnstr_task(obj_arg job, obj_arg c, obj_arg) {
+        par_cnstr_job & j = *reinterpret_cast<par_cnstr_job *>(unbox_size_t(job));
+        unsigned chunk = unbox(c);
+        dec(job);
+        scope_interrupt_state scope(j.m_interrupt);
+        try {
+            for (unsigned i = j.m_chunk_begin[chunk]; i < j.m_chunk_begin[chunk+1]; i++) {
+                expr r = j.m_fn(*j.m_workers[chunk], i);
+                theorem_ai::mark_mt(r.raw());
+                j.m_results[i] = r;
+            }
+        } catch (...) {
+            j.m_errors[chunk] = std::current_exception();
+        }
+        // the worker thread may not check declarations again for a long time
+        equiv_manager::clear_persistent();
+        return box(0);
+    }
+
+    /* Return `fn(*this, i)` for each `i < n`, in order.
+
+       When there are enough work items, they are split into chunks processed by parallel tasks, each using a copy
+       of this object with its own local context and name generator. Thus `fn` must not modify anything but the
+       local context and the name generator, and its result must not contain the free variables it creates.
+       The objects captured by `fn` must be marked as multi-threaded. If several work items fail, the exception of
+       the first one is rethrown, as when processing them sequentially. */
+    buffer<expr> par_map(unsigned n, std::function<expr(add_inductive_fn &, unsigned)> const & fn) {
+        buffer<expr> r;
+        // diagnostics are collected by the type checkers, which are not thread-safe
+        if (n < g_par_min_cnstrs || m_diag || hardware_concurrency() <= 1) {
+            for (unsigned i = 0; i < n; i++)
+                r.push_back(fn(*this, i));
+            return r;
+        }
+        mark_mt();
+        par_cnstr_job job;
+        job.m_fn = fn;
+        job.m_interrupt = capture_interrupt_state();
+        unsigned nchunks = std::min(n, 2 * hardware_concurrency());
+        for (unsigned c = 0; c <= nchunks; c++)
+            job.m_chunk_begin.push_back(static_cast<unsigned>((static_cast<uint64>(n) * c) / nchunks));
+        for (unsigned c = 0; c < nchunks; c++) {
+            job.m_workers.emplace_back(new add_inductive_fn(*this));
+            job.m_workers.back()->m_ngen = m_ngen.mk_child();
+        }
+        job.m_results.resize(n);
+        job.m_errors.resize(nchunks);
+        std::vector<object_ref> tasks;
+        for (unsigned c = 0; c < nchunks; c++) {
+            object * cl = alloc_closure(par_cnstr_task, 2);
+            closure_set(cl, 0, box_size_t(reinterpret_cast<size_t>(&job)));
+            closure_set(cl, 1, box(c));
+            tasks.push_back(object_ref(task_spawn(cl)));
+        }
+        // wait for all tasks before rethrowing, as they reference `job`
+        for (object_ref const & t : tasks)
+            task_get(t.raw());
+        for (std::exception_ptr const & ex : job.m_errors) {
+            if (ex)
+                std::rethrow_exception(ex);
+        }
+        for (expr const & e : job.m_results)
+            r.push_back(e);
+        return r;
+    }
+
     /** Return type of the parameter at position `i` */
     expr get_param_type(unsigned i) const {
         return m_lctx.get_local_decl(m_params[i]).get_type();
@@ -407,49 +518,80 @@ public:
         }
     }
 
-    /** \brief Check whether the constructor declarations are type correct, parameters are in the expected positions,
-        constructor fields are in acceptable universe levels, positivity constraints, and returns the expected result. */
-    void check_constructors() {
+    /** \brief Store the constructors of the inductive datatypes being declared, with the index of their datatype. */
+    void collect_cnstrs(buffer<pair<unsigned, constructor>> & cnstrs) {
         for (unsigned idx = 0; idx < m_ind_types.size(); idx++) {
-            inductive_type const & ind_type = m_ind_types[idx];
-            name_set found_cnstrs;
-            for (constructor const & cnstr : ind_type.get_cnstrs()) {
-                name const & n = constructor_name(cnstr);
+            for (constructor const & cnstr : m_ind_types[idx].get_cnstrs())
+                cnstrs.push_back(mk_pair(idx, cnstr));
+        }
+    }
+
+    /** \brief Check whether the declaration of constructor `cnstr` of the `idx`-th datatype is type correct, parameters
+        are in the expected positions, constructor fields are in acceptable universe levels, positivity constraints,
+        and returns the expected result. */
+    void check_constructor(unsigned idx, constructor const & cnstr) {
+        name const & n = constructor_name(cnstr);
+        expr t = constructor_type(cnstr);
+        check_no_metavar_no_fvar(m_env, n, t);
+        tc().check(t, m_lparams);
+        unsigned i = 0;
+        while (is_pi(t)) {
+            if (i < m_nparams) {
+                if (!is_def_eq(binding_domain(t), get_param_type(i)))
+                    throw kernel_exception(m_env, sstream() << "arg #" << (i + 1) << " of '" << n << "' "
+                                           << "does not match inductive datatypes parameters'");
+                t = instantiate(binding_body(t), m_params[i]);
+            } else {
+                expr s = tc().ensure_type(binding_domain(t));
+                // the sort is ok IF
+                //   1- its level is <= inductive datatype level, OR
+                //   2- is an inductive predicate
+                if (!(is_geq(m_result_level, sort_level(s)) || is_zero(m_result_level))) {
+                    throw kernel_exception(m_env, sstream() << "universe level of type_of(arg #" << (i + 1) << ") "
+                                           << "of '" << n << "' is too big for the corresponding inductive datatype");
+                }
+                if (!m_is_unsafe)
+                    check_positivity(binding_domain(t), n, i);
+                expr local = mk_local_decl_for(t);
+                t = instantiate(binding_body(t), local);
+            }
+            i++;
+        }
+        if (!is_valid_ind_app(t, idx))
+            throw kernel_exception(m_env, sstream() << "invalid return type for '" << n << "'");
+    }
+
+    /** \brief Check the names and declarations of the constructors. The declarations are checked by `par_map`;
+        the names are checked first, and the declarations of the constructors preceding the first invalid name are
+        checked before reporting it, so that errors are reported in the same order as by a sequential check. */
+    void check_constructors() {
+        buffer<pair<unsigned, constructor>> cnstrs;
+        collect_cnstrs(cnstrs);
+        std::exception_ptr name_ex;
+        unsigned nvalid = cnstrs.size();
+        name_set found_cnstrs;
+        for (unsigned i = 0; i < cnstrs.size(); i++) {
+            if (i > 0 && cnstrs[i].first != cnstrs[i-1].first)
+                found_cnstrs = name_set();
+            name const & n = constructor_name(cnstrs[i].second);
+            try {
                 if (found_cnstrs.contains(n)) {
                     throw kernel_exception(m_env, sstream() << "duplicate constructor name '" << n << "'");
                 }
                 found_cnstrs.insert(n);
-                expr t = constructor_type(cnstr);
                 m_env.check_name(n);
-                check_no_metavar_no_fvar(m_env, n, t);
-                tc().check(t, m_lparams);
-                unsigned i = 0;
-                while (is_pi(t)) {
-                    if (i < m_nparams) {
-                        if (!is_def_eq(binding_domain(t), get_param_type(i)))
-                            throw kernel_exception(m_env, sstream() << "arg #" << (i + 1) << " of '" << n << "' "
-                                                   << "does not match inductive datatypes parameters'");
-                        t = instantiate(binding_body(t), m_params[i]);
-                    } else {
-                        expr s = tc().ensure_type(binding_domain(t));
-                        // the sort is ok IF
-                        //   1- its level is <= inductive datatype level, OR
-                        //   2- is an inductive predicate
-                        if (!(is_geq(m_result_level, sort_level(s)) || is_zero(m_result_level))) {
-                            throw kernel_exception(m_env, sstream() << "universe level of type_of(arg #" << (i + 1) << ") "
-                                                   << "of '" << n << "' is too big for the corresponding inductive datatype");
-                        }
-                        if (!m_is_unsafe)
-                            check_positivity(binding_domain(t), n, i);
-                        expr local = mk_local_decl_for(t);
-                        t = instantiate(binding_body(t), local);
-                    }
-                    i++;
-                }
-                if (!is_valid_ind_app(t, idx))
-                    throw kernel_exception(m_env, sstream() << "invalid return type for '" << n << "'");
+            } catch (...) {
+                name_ex = std::current_exception();
+                nvalid  = i;
+                break;
             }
         }
+        par_map(nvalid, [&](add_inductive_fn & fn, unsigned i) {
+                fn.check_constructor(cnstrs[i].first, cnstrs[i].second);
+                return expr();
+            });
+        if (name_ex)
+            std::rethrow_exception(name_ex);
     }
 
     void declare_constructors() {
@@ -615,60 +757,66 @@ public:
             d_idx++;
         }
         /* First, populate the field m_minors */
-        d_idx = 0;
-        for (inductive_type const & ind_type : m_ind_types) {
-            name ind_type_name = ind_type.get_name();
-            for (constructor const & cnstr : ind_type.get_cnstrs()) {
-                buffer<expr> b_u; // nonrec and rec args;
-                buffer<expr> u;   // rec args
-                buffer<expr> v;   // inductive args
-                name cnstr_name = constructor_name(cnstr);
-                expr t          = constructor_type(cnstr);
-                unsigned i      = 0;
-                while (is_pi(t)) {
-                    if (i < m_nparams) {
-                        t = instantiate(binding_body(t), m_params[i]);
-                    } else {
-                        expr l = mk_local_decl_for(t);
-                        b_u.push_back(l);
-                        if (is_rec_argument(binding_domain(t)))
-                            u.push_back(l);
-                        t = instantiate(binding_body(t), l);
-                    }
-                    i++;
-                }
-                buffer<expr> it_indices;
-                unsigned it_idx = get_I_indices(t, it_indices);
-                expr C_app      = mk_app(m_rec_infos[it_idx].m_C, it_indices);
-                expr intro_app  = mk_app(mk_app(mk_constant(cnstr_name, m_levels), m_params), b_u);
-                C_app = mk_app(C_app, intro_app);
-                /* populate v using u */
-                for (unsigned i = 0; i < u.size(); i++) {
-                    expr u_i    = u[i];
-                    expr u_i_ty = whnf(infer_type(u_i));
-                    buffer<expr> xs;
-                    while (is_pi(u_i_ty)) {
-                        expr x = mk_local_decl_for(u_i_ty);
-                        xs.push_back(x);
-                        u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
-                    }
-                    buffer<expr> it_indices;
-                    unsigned it_idx = get_I_indices(u_i_ty, it_indices);
-                    expr C_app  = mk_app(m_rec_infos[it_idx].m_C, it_indices);
-                    expr u_app  = mk_app(u_i, xs);
-                    C_app = mk_app(C_app, u_app);
-                    expr v_i_ty = mk_pi(xs, C_app);
-                    local_decl u_i_decl = m_lctx.get_local_decl(fvar_name(u_i));
-                    expr v_i    = mk_local_decl(u_i_decl.get_user_name().append_after("_ih"), v_i_ty, binder_info());
-                    v.push_back(v_i);
-                }
-                expr minor_ty   = mk_pi(b_u, mk_pi(v, C_app));
-                name minor_name = cnstr_name.replace_prefix(ind_type_name, name());
-                expr minor      = mk_local_decl(minor_name, minor_ty);
-                m_rec_infos[d_idx].m_minors.push_back(minor);
+        buffer<pair<unsigned, constructor>> cnstrs;
+        collect_cnstrs(cnstrs);
+        buffer<expr> minor_tys = par_map(cnstrs.size(), [&](add_inductive_fn & fn, unsigned i) {
+                return fn.mk_minor_premise_type(cnstrs[i].second);
+            });
+        for (unsigned i = 0; i < cnstrs.size(); i++) {
+            unsigned d_idx  = cnstrs[i].first;
+            name minor_name = constructor_name(cnstrs[i].second).replace_prefix(m_ind_types[d_idx].get_name(), name());
+            expr minor      = mk_local_decl(minor_name, minor_tys[i]);
+            m_rec_infos[d_idx].m_minors.push_back(minor);
+        }
+    }
+
+    /** \brief Return the type of the minor premise for the given constructor. It only contains the free variables
+        of the parameters and motives. */
+    expr mk_minor_premise_type(constructor const & cnstr) {
+        buffer<expr> b_u; // nonrec and rec args;
+        buffer<expr> u;   // rec args
+        buffer<expr> v;   // inductive args
+        name cnstr_name = constructor_name(cnstr);
+        expr t          = constructor_type(cnstr);
+        unsigned i      = 0;
+        while (is_pi(t)) {
+            if (i < m_nparams) {
+                t = instantiate(binding_body(t), m_params[i]);
+            } else {
+                expr l = mk_local_decl_for(t);
+                b_u.push_back(l);
+                if (is_rec_argument(binding_domain(t)))
+                    u.push_back(l);
+                t = instantiate(binding_body(t), l);
             }
-            d_idx++;
+            i++;
+        }
+        buffer<expr> it_indices;
+        unsigned it_idx = get_I_indices(t, it_indices);
+        expr C_app      = mk_app(m_rec_infos[it_idx].m_C, it_indices);
+        expr intro_app  = mk_app(mk_app(mk_constant(cnstr_name, m_levels), m_params), b_u);
+        C_app = mk_app(C_app, intro_app);
+        /* populate v using u */
+        for (unsigned i = 0; i < u.size(); i++) {
+            expr u_i    = u[i];
+            expr u_i_ty = whnf(infer_type(u_i));
+            buffer<expr> xs;
+            while (is_pi(u_i_ty)) {
+                expr x = mk_local_decl_for(u_i_ty);
+                xs.push_back(x);
+                u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
+            }
+            buffer<expr> it_indices;
+            unsigned it_idx = get_I_indices(u_i_ty, it_indices);
+            expr C_app  = mk_app(m_rec_infos[it_idx].m_C, it_indices);
+            expr u_app  = mk_app(u_i, xs);
+            C_app = mk_app(C_app, u_app);
+            expr v_i_ty = mk_pi(xs, C_app);
+            local_decl u_i_decl = m_lctx.get_local_decl(fvar_name(u_i));
+            expr v_i    = mk_local_decl(u_i_decl.get_user_name().append_after("_ih"), v_i_ty, binder_info());
+            v.push_back(v_i);
         }
+        return mk_pi(b_u, mk_pi(v, C_app));
     }
 
     /** \brief Return the levels for the recursor. */
@@ -700,47 +848,60 @@ public:
             ms.append(m_rec_infos[i].m_minors);
     }
 
-    recursor_rules mk_rec_rules(unsigned d_idx, buffer<expr> const & Cs, buffer<expr> const & minors, unsigned & minor_idx) {
-        inductive_type const & d = m_ind_types[d_idx];
+    /** \brief Return the right-hand side of the recursor rule for the given constructor, whose minor premise
+        is `minors[minor_idx]`. */
+    expr mk_rec_rule_rhs(constructor const & cnstr, buffer<expr> const & Cs, buffer<expr> const & minors, unsigned minor_idx) {
         levels lvls = get_rec_levels();
+        buffer<expr> b_u;
+        buffer<expr> u;
+        expr t = constructor_type(cnstr);
+        unsigned i = 0;
+        while (is_pi(t)) {
+            if (i < m_nparams) {
+                t = instantiate(binding_body(t), m_params[i]);
+            } else {
+                expr l = mk_local_decl_for(t);
+                b_u.push_back(l);
+                if (is_rec_argument(binding_domain(t)))
+                    u.push_back(l);
+                t = instantiate(binding_body(t), l);
+            }
+            i++;
+        }
+        buffer<expr> v;
+        for (unsigned i = 0; i < u.size(); i++) {
+            expr u_i    = u[i];
+            expr u_i_ty = whnf(infer_type(u_i));
+            buffer<expr> xs;
+            while (is_pi(u_i_ty)) {
+                expr x = mk_local_decl_for(u_i_ty);
+                xs.push_back(x);
+                u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
+            }
+            buffer<expr> it_indices;
+            unsigned it_idx = get_I_indices(u_i_ty, it_indices);
+            name rec_name   = mk_rec_name(m_ind_types[it_idx].get_name());
+            expr rec_app    = mk_constant(rec_name, lvls);
+            rec_app         = mk_app(mk_app(mk_app(mk_app(mk_app(rec_app, m_params), Cs), minors), it_indices), mk_app(u_i, xs));
+            v.push_back(mk_lambda(xs, rec_app));
+        }
+        expr e_app = mk_app(mk_app(minors[minor_idx], b_u), v);
+        return mk_lambda(m_params, mk_lambda(Cs, mk_lambda(minors, mk_lambda(b_u, e_app))));
+    }
+
+    /** \brief Return the recursor rules of the `d_idx`-th datatype, given the right-hand sides `rhss` of the
+        rules of all constructors. */
+    recursor_rules mk_rec_rules(unsigned d_idx, buffer<expr> const & rhss, unsigned & minor_idx) {
+        inductive_type const & d = m_ind_types[d_idx];
         buffer<recursor_rule> rules;
         for (constructor const & cnstr : d.get_cnstrs()) {
-            buffer<expr> b_u;
-            buffer<expr> u;
+            unsigned nfields = 0;
             expr t = constructor_type(cnstr);
-            unsigned i = 0;
-            while (is_pi(t)) {
-                if (i < m_nparams) {
-                    t = instantiate(binding_body(t), m_params[i]);
-                } else {
-                    expr l = mk_local_decl_for(t);
-                    b_u.push_back(l);
-                    if (is_rec_argument(binding_domain(t)))
-                        u.push_back(l);
-                    t = instantiate(binding_body(t), l);
-                }
-                i++;
-            }
-            buffer<expr> v;
-            for (unsigned i = 0; i < u.size(); i++) {
-                expr u_i    = u[i];
-                expr u_i_ty = whnf(infer_type(u_i));
-                buffer<expr> xs;
-                while (is_pi(u_i_ty)) {
-                    expr x = mk_local_decl_for(u_i_ty);
-                    xs.push_back(x);
-                    u_i_ty = whnf(instantiate(binding_body(u_i_ty), x));
-                }
-                buffer<expr> it_indices;
-                unsigned it_idx = get_I_indices(u_i_ty, it_indices);
-                name rec_name   = mk_rec_name(m_ind_types[it_idx].get_name());
-                expr rec_app    = mk_constant(rec_name, lvls);
-                rec_app         = mk_app(mk_app(mk_app(mk_app(mk_app(rec_app, m_params), Cs), minors), it_indices), mk_app(u_i, xs));
-                v.push_back(mk_lambda(xs, rec_app));
+            for (unsigned i = 0; is_pi(t); i++, t = binding_body(t)) {
+                if (i >= m_nparams)
+                    nfields++;
             }
-            expr e_app    = mk_app(mk_app(minors[minor_idx], b_u), v);
-            expr comp_rhs = mk_lambda(m_params, mk_lambda(Cs, mk_lambda(minors, mk_lambda(b_u, e_app))));
-            rules.push_back(recursor_rule(constructor_name(cnstr), b_u.size(), comp_rhs));
+            rules.push_back(recursor_rule(constructor_name(cnstr), nfields, rhss[minor_idx]));
             minor_idx++;
         }
         return recursor_rules(rules);
@@ -753,6 +914,11 @@ public:
         unsigned nminors   = minors.size();
         unsigned nmotives  = Cs.size();
         names all          = get_all_inductive_names();
+        buffer<pair<unsigned, constructor>> cnstrs;
+        collect_cnstrs(cnstrs);
+        buffer<expr> rhss  = par_map(cnstrs.size(), [&](add_inductive_fn & fn, unsigned i) {
+                return fn.mk_rec_rule_rhs(cnstrs[i].second, Cs, minors, i);
+            });
         unsigned minor_idx = 0;
         for (unsigned d_idx = 0; d_idx < m_ind_types.size(); d_idx++) {
             rec_info const & info = m_rec_infos[d_idx];
@@ -763,7 +929,7 @@ public:
             rec_ty                = mk_pi(Cs, rec_ty);
             rec_ty                = mk_pi(m_params, rec_ty);
             rec_ty                = infer_implicit(rec_ty, true /* strict */);
-            recursor_rules rules  = mk_rec_rules(d_idx, Cs, minors, minor_idx);
+            recursor_rules rules  = mk_rec_rules(d_idx, rhss, minor_idx);
             name rec_name         = mk_rec_name(m_ind_types[d_idx].get_name());
             names rec_lparams     = get_rec_lparams();
             m_env.add_core(constant_info(recursor_val(rec_name, rec_lparams, rec_ty, all,
@@ -831,6 +997,16 @@ struct elim_nested_inductive_result {
             As.push_back(lctx.mk_local_decl(m_ngen, binding_name(e), binding_domain(e), binding_info(e)));
             e = instantiate(binding_body(e), As.back());
         }
+        /* The nested occurrences with the parameters `As`, by auxiliary type. The same auxiliary type usually occurs
+           many times in `e`. */
+        name_map<expr> new_nested_cache;
+        auto get_new_nested = [&](name const & auxI_name, expr const & nested) {
+            if (expr const * r = new_nested_cache.find(auxI_name))
+                return *r;
+            expr r = instantiate_rev(abstract(nested, m_params.size(), m_params.data()), As.size(), As.data());
+            new_nested_cache.insert(auxI_name, r);
+            return r;
+        };
         e = replace(e, [&](expr const & t, unsigned) {
                 if (is_constant(t)) {
                     if (name const * rec_name = aux_rec_name_map.find(const_name(t))) {
@@ -843,7 +1019,7 @@ struct elim_nested_inductive_result {
                         buffer<expr> args;
                         get_app_args(t, args);
                         lean_assert(args.size() >= m_params.size());
-                        expr new_t = instantiate_rev(abstract(*nested, m_params.size(), m_params.data()), As.size(), As.data());
+                        expr new_t = get_new_nested(const_name(fn), *nested);
                         return some_expr(mk_app(new_t, args.size() - m_params.size(), args.data() + m_params.size()));
                     }
                     if (optional<pair<expr, name>> r = get_nested_if_aux_constructor(aux_env, const_name(fn))) {
@@ -853,7 +1029,7 @@ struct elim_nested_inductive_result {
                         buffer<expr> args;
                         get_app_args(t, args);
                         lean_assert(args.size() >= m_params.size());
-                        expr new_nested = instantiate_rev(abstract(nested, m_params.size(), m_params.data()), As.size(), As.data());
+                        expr new_nested = get_new_nested(auxI_name, nested);
                         buffer<expr> I_args;
                         expr I = get_app_args(new_nested, I_args);
                         lean_assert(is_constant(I));
@@ -883,6 +1059,8 @@ struct elim_nested_inductive_fn {
     local_ctx                  m_params_lctx;
     buffer<expr>               m_params;
     buffer<pair<expr, name>>   m_nested_aux; /* The expressions stored here contains free vars in `m_params` */
+    /* `m_nested_aux` as a map, to find the auxiliary type of a nested occurrence without comparing it with all of them. */
+    expr_map<name>             m_nested_aux_map;
     levels                     m_lvls;
     buffer<inductive_type>     m_new_types;
     unsigned                   m_next_idx{1};
@@ -973,16 +1151,13 @@ struct elim_nested_inductive_fn {
         /* Replace `As` with `m_params` before searching at `m_nested_aux`.
            We need this step because we re-create parameters for each constructor with the correct binding info */
         expr Iparams = replace_params(IAs, As);
-        for (pair<expr, name> const & p : m_nested_aux) {
-            /* Remark: we could have used `is_def_eq` here instead of structural equality.
-               It is probably not needed, but if one day we decide to do it, we have to populate
-               an auxiliary environment with the inductive datatypes we are defining since `p.first` and `Iparams`
-               contain references to them. */
-            if (p.first == Iparams) {
-                auxI_name = p.second;
-                break;
-            }
-        }
+        /* Remark: we could have used `is_def_eq` here instead of structural equality.
+           It is probably not needed, but if one day we decide to do it, we have to populate
+           an auxiliary environment with the inductive datatypes we are defining since the keys of `m_nested_aux` and
+           `Iparams` contain references to them. */
+        auto it = m_nested_aux_map.find(Iparams);
+        if (it != m_nested_aux_map.end())
+            auxI_name = it->second;
         if (auxI_name) {
             expr auxI = mk_constant(*auxI_name, m_lvls);
             auxI      = mk_app(auxI, As);
@@ -1001,6 +1176,7 @@ struct elim_nested_inductive_fn {
                 auxJ_type            = instantiate_pi_params(auxJ_type, I_nparams, args.data());
                 auxJ_type            = lctx.mk_pi(As, auxJ_type);
                 m_nested_aux.push_back(mk_pair(replace_params(JAs, As), auxJ_name));
+                m_nested_aux_map.insert(m_nested_aux.back());
                 if (J_name == I_name) {
                     /* Create result */
                     expr auxI = mk_constant(auxJ_name, m_lvls);
@@ -1113,7 +1289,7 @@ static pair<names, name_map<name>> mk_aux_rec_name_map(environment const & aux_e
 environment environment::add_inductive(declaration const & d) const {
     elim_nested_inductive_result res = elim_nested_inductive_fn(*this, d)();
     unsigned nnested = res.m_aux2nested.size();
-    scoped_diagnostics diag(*this, true);
+    scoped_diagnostics diag(*this, true, head(inductive_decl(d).get_types()).get_name());
     environment aux_env = add_inductive_fn(*this, diag.get(), inductive_decl(res.m_aux_decl), nnested)();
     if (!nnested) {
         /* `d` did not contain nested inductive types. */
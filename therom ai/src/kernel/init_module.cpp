@@ -13,6 +13,7 @@ Author: Leonardo de Moura
 #include "kernel/local_ctx.h"
 #include "kernel/inductive.h"
 #include "kernel/quot.h"
+#include "kernel/equiv_manager.h"
 #include "kernel/trace.h"
 
 namespace theorem_ai {
@@ -20,6 +21,7 @@ void initialize_kernel_module() {
     initialize_level();
     initialize_expr();
     initialize_declaration();
+    initialize_equiv_manager();
     initialize_type_checker();
     initialize_environment();
     initialize_local_ctx();
@@ -35,6 +37,7 @@ void finalize_kernel_module() {
     finalize_local_ctx();
     finalize_environment();
     finalize_type_checker();
+    finalize_equiv_manager();
     finalize_declaration();
     finalize_expr();
     finalize_level();
@@ -15,7 +15,7 @@ namespace theorem_ai {
 expr instantiate(expr const & a, unsigned s, unsigned n, expr const * subst) {
     if (s >= get_loose_bvar_range(a) || n == 0)
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    return replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             unsigned s1 = s + offset;
             if (s1 < s)
                 return some_expr(m); // overflow, vidx can't be >= max unsigned
@@ -58,7 +58,7 @@ static object * lean_expr_instantiate_core(b_obj_arg a0, size_t n, object** subs
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    expr r = replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -99,7 +99,7 @@ extern "C" LEAN_EXPORT object * lean_expr_instantiate_range(b_obj_arg a, b_obj_a
 expr instantiate_rev(expr const & a, unsigned n, expr const * subst) {
     if (!has_loose_bvars(a))
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    return replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -123,7 +123,7 @@ static object * lean_expr_instantiate_rev_core(object * a0, size_t n, object **
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    expr r = replace_rec(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -232,7 +232,7 @@ expr cheap_beta_reduce(expr const & e) {
 expr instantiate_lparams(expr const & e, names const & lps, levels const & ls) {
     if (!has_param_univ(e))
         return e;
-    return replace(e, [&](expr const & e) -> optional<expr> {
+    return replace_rec(e, [&](expr const & e, unsigned) -> optional<expr> {
             if (!has_param_univ(e))
                 return some_expr(e);
             if (is_constant(e)) {
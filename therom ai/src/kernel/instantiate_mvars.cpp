@@ -4,9 +4,15 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Authors: Leonardo de Moura
 */
+#include <algorithm>
+#include <exception>
+#include <memory>
 #include <vector>
-#include <unordered_map>
+#include "runtime/thread.h"
+#include "runtime/interrupt.h"
 #include "util/name_set.h"
+#include "util/name_hash_map.h"
+#include "util/ptr_map.h"
 #include "runtime/option_ref.h"
 #include "runtime/array_ref.h"
 #include "kernel/instantiate.h"
@@ -31,27 +37,76 @@ option_ref<level> get_lmvar_assignment(metavar_ctx & mctx, name const & mid) {
     return option_ref<level>(lean_get_lmvar_assignment(mctx.to_obj_arg(), mid.to_obj_arg()));
 }
 
+/*
+State shared by the tasks of a parallel `instantiate_mvars_fn` (see `instantiate_mvars_fn::visit_args`).
+While tasks are running, the metavariable context is not modified: it is marked as multi-threaded and
+only read, and the normalized assignments are recorded here instead. They are written back to the
+metavariable context when the traversal is finished. The tasks run with the heartbeats, heartbeat limit,
+and cancel token of the thread that started the traversal.
+*/
+struct instantiate_mvars_par {
+    metavar_ctx          m_mctx;
+    unsigned             m_max_tasks;
+    atomic<unsigned>     m_num_tasks;
+    mutex                m_mutex;
+    name_hash_map<expr>  m_eassignment;
+    name_hash_map<level> m_lassignment;
+    std::exception_ptr   m_ex; // first exception thrown by a task
+    interrupt_state      m_interrupt;
+
+    explicit instantiate_mvars_par(metavar_ctx const & mctx):
+        m_mctx(mctx), m_max_tasks(2 * hardware_concurrency()), m_num_tasks(0),
+        m_interrupt(capture_interrupt_state()) {
+        mark_mt(m_mctx.raw());
+    }
+
+    template<typename T> optional<T> find(name_hash_map<T> const & m, name const & mid) {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m.find(mid);
+        return it == m.end() ? optional<T>() : optional<T>(it->second);
+    }
+
+    /* Record `v` as the normalized assignment of `mid`, and return the recorded one, which may have
+       been computed by another task. */
+    template<typename T> T insert(name_hash_map<T> & m, name const & mid, T const & v) {
+        mark_mt(mid.raw());
+        mark_mt(v.raw());
+        lock_guard<mutex> lock(m_mutex);
+        return m.emplace(mid, v).first->second;
+    }
+
+    bool reserve_task() {
+        unsigned n = ++m_num_tasks;
+        if (n > m_max_tasks) {
+            --m_num_tasks;
+            return false;
+        }
+        return true;
+    }
+};
+
 class instantiate_lmvars_fn {
     metavar_ctx & m_mctx;
-    std::unordered_map<lean_object *, level> m_cache;
+    instantiate_mvars_par * m_par;
+    ptr_map<lean_object *, level> m_cache;
     std::vector<level> m_saved; // Helper vector to prevent values from being garbage collected
 
     inline level cache(level const & l, level r, bool shared) {
         if (shared) {
-            m_cache.insert(mk_pair(l.raw(), r));
+            m_cache.insert(l.raw(), r);
         }
         return r;
     }
 public:
-    instantiate_lmvars_fn(metavar_ctx & mctx):m_mctx(mctx) {}
+    instantiate_lmvars_fn(metavar_ctx & mctx, instantiate_mvars_par * par = nullptr):m_mctx(mctx), m_par(par) {}
+    void set_par(instantiate_mvars_par * par) { m_par = par; }
     level visit(level const & l) {
         if (!has_mvar(l))
             return l;
         bool shared = false;
         if (is_shared(l)) {
-            auto it = m_cache.find(l.raw());
-            if (it != m_cache.end()) {
-                return it->second;
+            if (level const * r = m_cache.find(l.raw())) {
+                return *r;
             }
             shared = true;
         }
@@ -63,6 +118,10 @@ public:
         case level_kind::Zero: case level_kind::Param:
             lean_unreachable();
         case level_kind::MVar: {
+            if (m_par) {
+                if (optional<level> r = m_par->find(m_par->m_lassignment, mvar_id(l)))
+                    return *r;
+            }
             option_ref<level> r = get_lmvar_assignment(m_mctx, mvar_id(l));
             if (!r) {
                 return l;
@@ -73,6 +132,8 @@ public:
                 } else {
                     level a_new = visit(a);
                     if (!is_eqp(a, a_new)) {
+                        if (m_par)
+                            return m_par->insert(m_par->m_lassignment, mvar_id(l), a_new);
                         /*
                         We save `a` to ensure it will not be garbage collected
                         after we update `mctx`. This is necessary because `m_cache`
@@ -120,7 +181,7 @@ expr replace_fvars(expr const & e, array_ref<expr> const & fvars, expr const * r
     size_t sz = fvars.size();
     if (sz == 0)
         return e;
-    return replace(e, [=](expr const & m, unsigned offset) -> optional<expr> {
+    return replace_rec(e, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (!has_fvar(m))
                 return some_expr(m); // expression m does not contain free variables
             if (is_fvar(m)) {
@@ -137,12 +198,22 @@ expr replace_fvars(expr const & e, array_ref<expr> const & fvars, expr const * r
         });
 }
 
+/* Number of nodes visited sequentially before `instantiate_mvars_fn` starts using tasks. */
+static constexpr unsigned g_par_min_visited = 1u << 16;
+/* Minimal estimated size of a subterm visited by a separate task. */
+static constexpr unsigned g_par_min_size    = 1u << 12;
+
 class instantiate_mvars_fn {
     metavar_ctx & m_mctx;
     instantiate_lmvars_fn m_level_fn;
     name_set m_already_normalized; // Store metavariables whose assignment has already been normalized.
-    std::unordered_map<lean_object *, expr> m_cache;
+    ptr_map<lean_object *, expr> m_cache;
     std::vector<expr> m_saved; // Helper vector to prevent values from being garbage collected
+    bool m_can_par;            // Whether this traversal may start using tasks
+    unsigned m_num_visited = 0;
+    std::unique_ptr<instantiate_mvars_par> m_par_owner;
+    instantiate_mvars_par * m_par = nullptr;
+    ptr_map<lean_object *, unsigned> m_size_cache;
 
     level visit_level(level const & l) {
         return m_level_fn(l);
@@ -157,12 +228,16 @@ class instantiate_mvars_fn {
 
     inline expr cache(expr const & e, expr r, bool shared) {
         if (shared) {
-            m_cache.insert(mk_pair(e.raw(), r));
+            m_cache.insert(e.raw(), r);
         }
         return r;
     }
 
     optional<expr> get_assignment(name const & mid) {
+        if (m_par) {
+            if (optional<expr> r = m_par->find(m_par->m_eassignment, mid))
+                return r;
+        }
         option_ref<expr> r = get_mvar_assignment(m_mctx, mid);
         if (!r) {
             return optional<expr>();
@@ -173,6 +248,10 @@ class instantiate_mvars_fn {
             } else {
                 m_already_normalized.insert(mid);
                 expr a_new = visit(a);
+                if (m_par) {
+                    // also record unchanged assignments, so that other tasks do not normalize them again
+                    return optional<expr>(m_par->insert(m_par->m_eassignment, mid, a_new));
+                }
                 if (!is_eqp(a, a_new)) {
                     /*
                     We save `a` to ensure it will not be garbage collected
@@ -187,19 +266,150 @@ class instantiate_mvars_fn {
         }
     }
 
+    /*
+    Estimate the cost of `visit(e)`: the number of nodes containing metavariables in `e` and in the
+    assignments of its metavariables, saturating at `g_par_min_size`.
+    */
+    unsigned estimate_size(expr const & e) {
+        if (!has_mvar(e))
+            return 1;
+        if (unsigned const * r = m_size_cache.find(e.raw()))
+            return *r;
+        unsigned r = 1;
+        auto add = [&](expr const & c) { if (r < g_par_min_size) r += estimate_size(c); };
+        switch (e.kind()) {
+        case expr_kind::MVar: {
+            option_ref<expr> a = get_mvar_assignment(m_par->m_mctx, mvar_name(e));
+            if (a)
+                add(expr(a.get_val()));
+            break;
+        }
+        case expr_kind::MData: add(mdata_expr(e)); break;
+        case expr_kind::Proj:  add(proj_expr(e)); break;
+        case expr_kind::App:   add(app_fn(e)); add(app_arg(e)); break;
+        case expr_kind::Pi: case expr_kind::Lambda:
+            add(binding_domain(e)); add(binding_body(e)); break;
+        case expr_kind::Let:
+            add(let_type(e)); add(let_value(e)); add(let_body(e)); break;
+        default:
+            break;
+        }
+        r = std::min(r, g_par_min_size);
+        m_size_cache.insert(e.raw(), r);
+        return r;
+    }
+
+    /* Start using tasks once the traversal turns out to be large. */
+    bool start_par() {
+        if (!m_can_par || m_num_visited < g_par_min_visited)
+            return false;
+        m_par_owner.reset(new instantiate_mvars_par(m_mctx));
+        m_par = m_par_owner.get();
+        m_level_fn.set_par(m_par);
+        return true;
+    }
+
+    /* Entry point of the tasks spawned by `visit_par`. */
+    static obj_res visit_task(obj_arg p, obj_arg e, obj_arg) {
+        instantiate_mvars_par * par = reinterpret_cast<instantiate_mvars_par *>(unbox_size_t(p));
+        dec(p);
+        expr e_(e);
+        scope_interrupt_state scope(par->m_interrupt);
+        try {
+            return instantiate_mvars_fn(par).visit(e_).steal();
+        } catch (...) {
+            lock_guard<mutex> lock(par->m_mutex);
+            if (!par->m_ex)
+                par->m_ex = std::current_exception();
+            return e_.steal();
+        }
+    }
+
+    /* Tasks spawned by `visit_par`. They are waited for even if an exception is thrown. */
+    class task_group {
+        instantiate_mvars_par & m_par;
+        buffer<object *> m_tasks;
+    public:
+        task_group(instantiate_mvars_par & par, unsigned n):m_par(par) { m_tasks.resize(n, nullptr); }
+        ~task_group() {
+            for (object * t : m_tasks) {
+                if (t) {
+                    task_get(t);
+                    dec(t);
+                    --m_par.m_num_tasks;
+                }
+            }
+        }
+        void spawn(unsigned i, expr const & e) {
+            object * c = alloc_closure(visit_task, 2);
+            closure_set(c, 0, box_size_t(reinterpret_cast<size_t>(&m_par)));
+            closure_set(c, 1, e.to_obj_arg());
+            m_tasks[i] = task_spawn(c);
+        }
+        bool spawned(unsigned i) const { return m_tasks[i] != nullptr; }
+        expr get(unsigned i) { return expr(task_get(m_tasks[i]), true); }
+    };
+
+    /*
+    Push `visit(*todo[i])` to `args` for each `i`. All large subterms but the last one are visited by
+    separate tasks, while this thread visits the remaining ones. Since the metavariable context is not
+    modified by the tasks, the result is the same as when visiting them sequentially.
+    */
+    void visit_par(buffer<expr const *> const & todo, buffer<expr> & args) {
+        buffer<unsigned> large;
+        for (unsigned i = 0; i < todo.size(); i++) {
+            if (estimate_size(*todo[i]) >= g_par_min_size)
+                large.push_back(i);
+        }
+        if (large.size() < 2) {
+            for (expr const * a : todo)
+                args.push_back(visit(*a));
+            return;
+        }
+        task_group tasks(*m_par, todo.size());
+        for (unsigned j = 0; j + 1 < large.size(); j++) {
+            if (m_par->reserve_task())
+                tasks.spawn(large[j], *todo[large[j]]);
+        }
+        unsigned start = args.size();
+        for (unsigned i = 0; i < todo.size(); i++)
+            args.push_back(tasks.spawned(i) ? expr() : visit(*todo[i]));
+        for (unsigned i = 0; i < todo.size(); i++) {
+            if (tasks.spawned(i))
+                args[start + i] = tasks.get(i);
+        }
+    }
+
+    /*
+    Given `e` of the form `f a_1 ... a_n`, push `visit(a_n)`, ..., `visit(a_1)` to `args` and return `f`.
+    */
+    expr const & visit_args(expr const & e, buffer<expr> & args) {
+        expr const * curr = &e;
+        if (m_par || start_par()) {
+            buffer<expr const *> todo;
+            while (is_app(*curr)) {
+                todo.push_back(&app_arg(*curr));
+                curr = &app_fn(*curr);
+            }
+            visit_par(todo, args);
+        } else {
+            while (is_app(*curr)) {
+                args.push_back(visit(app_arg(*curr)));
+                curr = &app_fn(*curr);
+            }
+        }
+        return *curr;
+    }
+
     /*
     Given `e` of the form `f a_1 ... a_n` where `f` is not a metavariable,
     instantiate metavariables.
     */
     expr visit_app_default(expr const & e) {
         buffer<expr> args;
-        expr const * curr = &e;
-        while (is_app(*curr)) {
-            args.push_back(visit(app_arg(*curr)));
-            curr = &app_fn(*curr);
-        }
-        lean_assert(!is_mvar(*curr));
-        expr f = visit(*curr);
+        expr const & fn = visit_args(e, args);
+        lean_assert(!is_mvar(fn));
+        expr f = visit(fn);
         return mk_rev_app(f, args.size(), args.data());
     }
 
@@ -209,13 +419,9 @@ class instantiate_mvars_fn {
     */
     expr visit_mvar_app_args(expr const & e) {
         buffer<expr> args;
-        expr const * curr = &e;
-        while (is_app(*curr)) {
-            args.push_back(visit(app_arg(*curr)));
-            curr = &app_fn(*curr);
-        }
-        lean_assert(is_mvar(*curr));
-        return mk_rev_app(*curr, args.size(), args.data());
+        expr const & fn = visit_args(e, args);
+        lean_assert(is_mvar(fn));
+        return mk_rev_app(fn, args.size(), args.data());
     }
 
     /*
@@ -223,11 +429,7 @@ class instantiate_mvars_fn {
     where `a_i'` is `visit(a_i)`. `args` is an accumulator for the new arguments.
     */
     expr visit_args_and_beta(expr const & f_new, expr const & e, buffer<expr> & args) {
-        expr const * curr = &e;
-        while (is_app(*curr)) {
-            args.push_back(visit(app_arg(*curr)));
-            curr = &app_fn(*curr);
-        }
+        visit_args(e, args);
         /*
           Some of the arguments in `args` are irrelevant after we beta
           reduce. Also, it may be a bug to not instantiate them, since they
@@ -252,11 +454,7 @@ class instantiate_mvars_fn {
     `ti'`s are `visit(ti)`.
     */
     expr visit_delayed(array_ref<expr> const & fvars, expr const & val, expr const & e, buffer<expr> & args) {
-        expr const * curr = &e;
-        while (is_app(*curr)) {
-            args.push_back(visit(app_arg(*curr)));
-            curr = &app_fn(*curr);
-        }
+        visit_args(e, args);
         expr val_new = replace_fvars(val, fvars, args.data() + (args.size() - fvars.size()));
         return mk_rev_app(val_new, args.size() - fvars.size(), args.data());
     }
@@ -321,20 +519,47 @@ class instantiate_mvars_fn {
         }
     }
 
+    /* Write the assignments normalized while using tasks back to the metavariable context. */
+    void finish_par() {
+        std::unique_ptr<instantiate_mvars_par> par(std::move(m_par_owner));
+        m_par = nullptr;
+        m_level_fn.set_par(nullptr);
+        if (par->m_ex)
+            std::rethrow_exception(par->m_ex);
+        for (auto const & p : par->m_lassignment)
+            assign_lmvar(m_mctx, p.first, p.second);
+        for (auto const & p : par->m_eassignment) {
+            option_ref<expr> a = get_mvar_assignment(m_mctx, p.first);
+            if (a.get_val().raw() != p.second.raw()) {
+                m_saved.push_back(a.get_val());
+                assign_mvar(m_mctx, p.first, p.second);
+            }
+        }
+    }
+
+    explicit instantiate_mvars_fn(instantiate_mvars_par * par):
+        m_mctx(par->m_mctx), m_level_fn(par->m_mctx, par), m_can_par(false), m_par(par) {}
+
 public:
-    instantiate_mvars_fn(metavar_ctx & mctx):m_mctx(mctx), m_level_fn(mctx) {}
+    instantiate_mvars_fn(metavar_ctx & mctx):m_mctx(mctx), m_level_fn(mctx) {
+#if defined(LEAN_MULTI_THREAD)
+        m_can_par = hardware_concurrency() > 1;
+#else
+        m_can_par = false;
+#endif
+    }
 
     expr visit(expr const & e) {
         if (!has_mvar(e))
             return e;
         bool shared = false;
         if (is_shared(e)) {
-            auto it = m_cache.find(e.raw());
-            if (it != m_cache.end()) {
-                return it->second;
+            if (expr const * r = m_cache.find(e.raw())) {
+                return *r;
             }
             shared = true;
         }
+        m_num_visited++;
 
         switch (e.kind()) {
         case expr_kind::BVar:
@@ -359,7 +584,12 @@ public:
         }
     }
 
-    expr operator()(expr const & e) { return visit(e); }
+    expr operator()(expr const & e) {
+        expr r = visit(e);
+        if (m_par_owner)
+            finish_par();
+        return r;
+    }
 };
 
 extern "C" LEAN_EXPORT object * lean_instantiate_expr_mvars(object * m, object * e) {
@@ -9,8 +9,79 @@ Author: Leonardo de Moura
 #include "runtime/interrupt.h"
 #include "kernel/expr.h"
 #include "kernel/expr_maps.h"
+#include "util/ptr_map.h"
 
 namespace theorem_ai {
+template<typename F>
+class replace_rec_fn {
+    ptr_map<std::pair<lean_object *, unsigned>, expr> m_cache;
+    F const &                                         m_f;
+    bool                                              m_use_cache;
+
+    expr save_result(expr const & e, unsigned offset, expr r, bool shared) {
+        if (shared)
+            m_cache.insert(mk_pair(e.raw(), offset), r);
+        return r;
+    }
+
+    expr apply(expr const & e, unsigned offset) {
+        bool shared = false;
+        if (m_use_cache && !is_likely_unshared(e)) {
+            if (expr const * r = m_cache.find(mk_pair(e.raw(), offset)))
+                return *r;
+            shared = true;
+        }
+        if (optional<expr> r = m_f(e, offset)) {
+            return save_result(e, offset, std::move(*r), shared);
+        } else {
+            switch (e.kind()) {
+            case expr_kind::Const: case expr_kind::Sort:
+            case expr_kind::BVar:  case expr_kind::Lit:
+            case expr_kind::MVar:  case expr_kind::FVar:
+                return save_result(e, offset, e, shared);
+            case expr_kind::MData: {
+                expr new_e = apply(mdata_expr(e), offset);
+                return save_result(e, offset, update_mdata(e, new_e), shared);
+            }
+            case expr_kind::Proj: {
+                expr new_e = apply(proj_expr(e), offset);
+                return save_result(e, offset, update_proj(e, new_e), shared);
+            }
+            case expr_kind::App: {
+                expr new_f = apply(app_fn(e), offset);
+                expr new_a = apply(app_arg(e), offset);
+                return save_result(e, offset, update_app(e, new_f, new_a), shared);
+            }
+            case expr_kind::Pi: case expr_kind::Lambda: {
+                expr new_d = apply(binding_domain(e), offset);
+                expr new_b = apply(binding_body(e), offset+1);
+                return save_result(e, offset, update_binding(e, new_d, new_b), shared);
+            }
+            case expr_kind::Let: {
+                expr new_t = apply(let_type(e), offset);
+                expr new_v = apply(let_value(e), offset);
+                expr new_b = apply(let_body(e), offset+1);
+                return save_result(e, offset, update_let(e, new_t, new_v, new_b), shared);
+            }
+            }
+            lean_unreachable();
+        }
+    }
+public:
+    replace_rec_fn(F const & f, bool use_cache):m_f(f), m_use_cache(use_cache) {}
+
+    expr operator()(expr const & e) { return apply(e, 0); }
+};
+
+/**
+   \brief Like `replace` below, but `f` can be any function object `optional<expr>(expr const &, unsigned)`.
+   The traversal is instantiated for the type of `f`, which avoids an indirect call per visited subterm;
+   use it for callbacks on hot paths such as `instantiate` and `abstract`.
+*/
+template<typename F> expr replace_rec(expr const & e, F const & f, bool use_cache = true) {
+    return replace_rec_fn<F>(f, use_cache)(e);
+}
+
 /**
    \brief Apply <tt>f</tt> to the subexpressions of a given expression.
 
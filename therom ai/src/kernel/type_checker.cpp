@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <chrono>
 #include "runtime/interrupt.h"
 #include "runtime/sstream.h"
 #include "runtime/flet.h"
@@ -40,9 +41,12 @@ static expr * g_nat_lor      = nullptr;
 static expr * g_nat_xor      = nullptr;
 static expr * g_nat_shiftLeft  = nullptr;
 static expr * g_nat_shiftRight = nullptr;
+static expr * g_nat_log2     = nullptr;
 
 type_checker::state::state(environment const & env):
-    m_env(env), m_ngen(*g_kernel_fresh) {}
+    m_env(env), m_ngen(*g_kernel_fresh) {
+    equiv_manager::bound_persistent();
+}
 
 /** \brief Make sure \c e "is" a sort, and return the corresponding sort.
     If \c e is not a sort, then the whnf procedure is invoked.
@@ -80,8 +84,74 @@ void type_checker::check_level(level const & l) {
     }
 }
 
+/* Save `m_lctx`, and restore it together with `m_fvar_decls` when the scope is exited. */
+class type_checker::lctx_scope {
+    type_checker & m_tc;
+    local_ctx      m_lctx;
+    size_t         m_num_fvars;
+public:
+    lctx_scope(type_checker & tc):m_tc(tc), m_lctx(tc.m_lctx), m_num_fvars(tc.m_fvar_decls.size()) {}
+    ~lctx_scope() {
+        m_tc.m_lctx = m_lctx;
+        m_tc.m_fvar_decls.erase(m_tc.m_fvar_decls.begin() + m_num_fvars, m_tc.m_fvar_decls.end());
+    }
+};
+
+/* Return the index of `n` in `m_fvar_decls` if it may have been created by `m_st->m_ngen`, or `-1`. */
+static size_t get_fvar_idx(name const & n, name const & prefix, unsigned base) {
+    if (n.is_numeral() && n.get_numeral().is_small() && n.get_prefix() == prefix &&
+        n.get_numeral().get_small_value() >= base)
+        return n.get_numeral().get_small_value() - base;
+    return static_cast<size_t>(-1);
+}
+
+expr type_checker::push_local_decl(local_decl const & d) {
+    if (m_fvar_decls.empty() && d.get_name().is_numeral() && d.get_name().get_numeral().is_small())
+        m_fvar_base = d.get_name().get_numeral().get_small_value();
+    size_t idx = get_fvar_idx(d.get_name(), m_st->m_ngen.prefix(), m_fvar_base);
+    if (idx != static_cast<size_t>(-1)) {
+        /* The names created by other type checkers sharing `m_st` leave holes, filled with the dummy declaration. */
+        if (idx >= m_fvar_decls.size())
+            m_fvar_decls.resize(idx + 1);
+        m_fvar_decls[idx] = d;
+    }
+    return d.mk_ref();
+}
+
+expr type_checker::mk_local_decl(name const & un, expr const & type, binder_info bi) {
+    return push_local_decl(m_lctx.mk_local_decl(m_st->m_ngen.next(), un, type, bi));
+}
+
+expr type_checker::mk_local_decl(name const & un, expr const & type, expr const & value) {
+    return push_local_decl(m_lctx.mk_local_decl(m_st->m_ngen.next(), un, type, value));
+}
+
+optional<local_decl> type_checker::find_local_decl(expr const & e) {
+    name const & n = fvar_name(e);
+    size_t idx = get_fvar_idx(n, m_st->m_ngen.prefix(), m_fvar_base);
+    if (idx < m_fvar_decls.size() && m_fvar_decls[idx].get_name() == n)
+        return optional<local_decl>(m_fvar_decls[idx]);
+    auto it = m_lctx_decls.find(n);
+    if (it != m_lctx_decls.end())
+        return optional<local_decl>(it->second);
+    optional<local_decl> decl = m_lctx.find_local_decl(n);
+    /* Only the declarations of the initial local context are cached, since they are never removed. */
+    if (decl && idx == static_cast<size_t>(-1))
+        m_lctx_decls.insert(mk_pair(n, *decl));
+    return decl;
+}
+
+bool type_checker::is_let_fvar(expr const & e) {
+    lean_assert(is_fvar(e));
+    if (optional<local_decl> decl = find_local_decl(e)) {
+        return static_cast<bool>(decl->get_value());
+    } else {
+        return false;
+    }
+}
+
 expr type_checker::infer_fvar(expr const & e) {
-    if (optional<local_decl> decl = m_lctx.find_local_decl(e)) {
+    if (optional<local_decl> decl = find_local_decl(e)) {
         return decl->get_type();
     } else {
         throw kernel_exception(env(), "unknown free variable");
@@ -113,12 +183,12 @@ expr type_checker::infer_constant(expr const & e, bool infer_only) {
 }
 
 expr type_checker::infer_lambda(expr const & _e, bool infer_only) {
-    flet<local_ctx> save_lctx(m_lctx, m_lctx);
+    lctx_scope save_lctx(*this);
     buffer<expr> fvars;
     expr e = _e;
     while (is_lambda(e)) {
         expr d    = instantiate_rev(binding_domain(e), fvars.size(), fvars.data());
-        expr fvar = m_lctx.mk_local_decl(m_st->m_ngen, binding_name(e), d, binding_info(e));
+        expr fvar = mk_local_decl(binding_name(e), d, binding_info(e));
         fvars.push_back(fvar);
         if (!infer_only) {
             ensure_sort_core(infer_type_core(d, infer_only), d);
@@ -131,7 +201,7 @@ expr type_checker::infer_lambda(expr const & _e, bool infer_only) {
 }
 
 expr type_checker::infer_pi(expr const & _e, bool infer_only) {
-    flet<local_ctx> save_lctx(m_lctx, m_lctx);
+    lctx_scope save_lctx(*this);
     buffer<expr> fvars;
     buffer<level> us;
     expr e = _e;
@@ -139,7 +209,7 @@ expr type_checker::infer_pi(expr const & _e, bool infer_only) {
         expr d  = instantiate_rev(binding_domain(e), fvars.size(), fvars.data());
         expr t1 = ensure_sort_core(infer_type_core(d, infer_only), d);
         us.push_back(sort_level(t1));
-        expr fvar  = m_lctx.mk_local_decl(m_st->m_ngen, binding_name(e), d, binding_info(e));
+        expr fvar  = mk_local_decl(binding_name(e), d, binding_info(e));
         fvars.push_back(fvar);
         e = binding_body(e);
     }
@@ -200,14 +270,14 @@ static void mark_used(unsigned n, expr const * fvars, expr const & b, bool * use
 }
 
 expr type_checker::infer_let(expr const & _e, bool infer_only) {
-    flet<local_ctx> save_lctx(m_lctx, m_lctx);
+    lctx_scope save_lctx(*this);
     buffer<expr> fvars;
     buffer<expr> vals;
     expr e = _e;
     while (is_let(e)) {
         expr type = instantiate_rev(let_type(e), fvars.size(), fvars.data());
         expr val  = instantiate_rev(let_value(e), fvars.size(), fvars.data());
-        expr fvar = m_lctx.mk_local_decl(m_st->m_ngen, let_name(e), type, val);
+        expr fvar = mk_local_decl(let_name(e), type, val);
         fvars.push_back(fvar);
         vals.push_back(val);
         if (!infer_only) {
@@ -367,7 +437,7 @@ optional<expr> type_checker::reduce_recursor(expr const & e, bool cheap_rec, boo
 }
 
 expr type_checker::whnf_fvar(expr const & e, bool cheap_rec, bool cheap_proj) {
-    if (optional<local_decl> decl = m_lctx.find_local_decl(e)) {
+    if (optional<local_decl> decl = find_local_decl(e)) {
         if (optional<expr> const & v = decl->get_value()) {
             /* zeta-reduction */
             return whnf_core(*v, cheap_rec, cheap_proj);
@@ -407,15 +477,6 @@ optional<expr> type_checker::reduce_proj(expr const & e, bool cheap_rec, bool ch
     return reduce_proj_core(c, idx);
 }
 
-static bool is_let_fvar(local_ctx const & lctx, expr const & e) {
-    lean_assert(is_fvar(e));
-    if (optional<local_decl> decl = lctx.find_local_decl(e)) {
-        return static_cast<bool>(decl->get_value());
-    } else {
-        return false;
-    }
-}
-
 /** \brief Weak head normal form core procedure. It does not perform delta reduction nor normalization extensions.
     If `cheap == true`, then we don't perform delta-reduction when reducing major premise of recursors and projections.
     We also do not cache results. */
@@ -431,7 +492,7 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     case expr_kind::MData:
         return whnf_core(mdata_expr(e), cheap_rec, cheap_proj);
     case expr_kind::FVar:
-        if (is_let_fvar(m_lctx, e))
+        if (is_let_fvar(e))
             break;
         else
             return e;
@@ -440,10 +501,16 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
         break;
     }
 
+    if (m_diag)
+        m_diag->get_def_eq_stats().m_whnf_core++;
+
     // check cache
     auto it = m_st->m_whnf_core.find(e);
-    if (it != m_st->m_whnf_core.end())
+    if (it != m_st->m_whnf_core.end()) {
+        if (m_diag)
+            m_diag->get_def_eq_stats().m_whnf_core_cache_hit++;
         return it->second;
+    }
 
     // do the actual work
     expr r;
@@ -579,33 +646,62 @@ optional<expr> reduce_native(environment const & env, expr const & e) {
 }
 
 static inline bool is_nat_lit_ext(expr const & e) { return e == *g_nat_zero || is_nat_lit(e); }
-static inline nat get_nat_val(expr const & e) {
+/* Return the value of `e`, which must satisfy `is_nat_lit_ext`, without copying it. */
+static inline b_obj_arg get_nat_obj(expr const & e) {
     lean_assert(is_nat_lit_ext(e));
-    if (e == *g_nat_zero) return nat((unsigned)0);
-    return lit_value(e).get_nat();
+    if (e == *g_nat_zero) return box(0);
+    return lit_value(e).get_nat().raw();
 }
 
-template<typename F> optional<expr> type_checker::reduce_bin_nat_op(F const & f, expr const & e) {
+/* Return a literal for the value `r` (consumed), reusing the literal `arg1` or `arg2` if it has the same value. */
+static expr mk_nat_lit_result(obj_arg r, expr const & arg1, expr const & arg2) {
+    if (!is_scalar(r)) {
+        for (expr const * arg : {&arg1, &arg2}) {
+            if (is_nat_lit(*arg) && nat_eq(r, get_nat_obj(*arg))) {
+                dec(r);
+                return *arg;
+            }
+        }
+    }
+    return mk_lit(literal(nat(r)));
+}
+
+/*
+Reduce `op a b` where `a` and `b` reduce to literals, and `f` implements `op`. `f` may return `nullptr` to
+leave the application unreduced.
+Results on big numbers are cached by the literals they are computed from, which are usually shared in the
+terms the kernel checks: e.g. in a `decide` proof, the same big constant is combined with the same
+arguments in many places.
+*/
+template<typename F> optional<expr> type_checker::reduce_bin_nat_op(expr const & op, F const & f, expr const & e) {
     expr arg1 = whnf(app_arg(app_fn(e)));
     if (!is_nat_lit_ext(arg1)) return none_expr();
     expr arg2 = whnf(app_arg(e));
     if (!is_nat_lit_ext(arg2)) return none_expr();
-    nat v1 = get_nat_val(arg1);
-    nat v2 = get_nat_val(arg2);
-    return some_expr(mk_lit(literal(nat(f(v1.raw(), v2.raw())))));
+    b_obj_arg v1 = get_nat_obj(arg1);
+    b_obj_arg v2 = get_nat_obj(arg2);
+    if (is_scalar(v1) && is_scalar(v2)) {
+        object * r = f(v1, v2);
+        return r ? some_expr(mk_lit(literal(nat(r)))) : none_expr();
+    }
+    state::nat_lit_key k{op.raw(), arg1.raw(), arg2.raw()};
+    auto it = m_st->m_nat_lit.find(k);
+    if (it != m_st->m_nat_lit.end())
+        return some_expr(it->second.m_result);
+    object * r = f(v1, v2);
+    if (!r) return none_expr();
+    expr e_r = mk_nat_lit_result(r, arg1, arg2);
+    m_st->m_nat_lit.insert(mk_pair(k, state::nat_lit_entry{arg1, arg2, e_r}));
+    return some_expr(e_r);
 }
 
 #define ReducePowMaxExp 1<<24 // TODO: make it configurable
 
 optional<expr> type_checker::reduce_pow(expr const & e) {
-    expr arg1 = whnf(app_arg(app_fn(e)));
-    if (!is_nat_lit_ext(arg1)) return none_expr();
-    expr arg2 = whnf(app_arg(e));
-    if (!is_nat_lit_ext(arg2)) return none_expr();
-    nat v1 = get_nat_val(arg1);
-    nat v2 = get_nat_val(arg2);
-    if (v2 > nat(ReducePowMaxExp)) return none_expr();
-    return some_expr(mk_lit(literal(nat(nat_pow(v1.raw(), v2.raw())))));
+    return reduce_bin_nat_op(*g_nat_pow, [](b_obj_arg v1, b_obj_arg v2) -> object * {
+            if (!is_scalar(v2) || unbox(v2) > ReducePowMaxExp) return nullptr;
+            return nat_pow(v1, v2);
+        }, e);
 }
 
 template<typename F> optional<expr> type_checker::reduce_bin_nat_pred(F const & f, expr const & e) {
@@ -613,9 +709,7 @@ template<typename F> optional<expr> type_checker::reduce_bin_nat_pred(F const &
     if (!is_nat_lit_ext(arg1)) return none_expr();
     expr arg2 = whnf(app_arg(e));
     if (!is_nat_lit_ext(arg2)) return none_expr();
-    nat v1 = get_nat_val(arg1);
-    nat v2 = get_nat_val(arg2);
-    return f(v1.raw(), v2.raw()) ? some_expr(mk_bool_true()) : some_expr(mk_bool_false());
+    return f(get_nat_obj(arg1), get_nat_obj(arg2)) ? some_expr(mk_bool_true()) : some_expr(mk_bool_false());
 }
 
 optional<expr> type_checker::reduce_nat(expr const & e) {
@@ -625,26 +719,30 @@ optional<expr> type_checker::reduce_nat(expr const & e) {
         if (f == *g_nat_succ) {
             expr arg = whnf(app_arg(e));
             if (!is_nat_lit_ext(arg)) return none_expr();
-            nat v = get_nat_val(arg);
-            return some_expr(mk_lit(literal(nat(v+nat(1)))));
+            return some_expr(mk_lit(literal(nat(nat_add(get_nat_obj(arg), box(1))))));
+        }
+        if (f == *g_nat_log2) {
+            expr arg = whnf(app_arg(e));
+            if (!is_nat_lit_ext(arg)) return none_expr();
+            return some_expr(mk_lit(literal(nat(lean_nat_log2(get_nat_obj(arg))))));
         }
     } else if (nargs == 2) {
         expr const & f = app_fn(app_fn(e));
         if (!is_constant(f)) return none_expr();
-        if (f == *g_nat_add) return reduce_bin_nat_op(nat_add, e);
-        if (f == *g_nat_sub) return reduce_bin_nat_op(nat_sub, e);
-        if (f == *g_nat_mul) return reduce_bin_nat_op(nat_mul, e);
+        if (f == *g_nat_add) return reduce_bin_nat_op(*g_nat_add, nat_add, e);
+        if (f == *g_nat_sub) return reduce_bin_nat_op(*g_nat_sub, nat_sub, e);
+        if (f == *g_nat_mul) return reduce_bin_nat_op(*g_nat_mul, nat_mul, e);
         if (f == *g_nat_pow) return reduce_pow(e);
-        if (f == *g_nat_gcd) return reduce_bin_nat_op(nat_gcd, e);
-        if (f == *g_nat_mod) return reduce_bin_nat_op(nat_mod, e);
-        if (f == *g_nat_div) return reduce_bin_nat_op(nat_div, e);
+        if (f == *g_nat_gcd) return reduce_bin_nat_op(*g_nat_gcd, nat_gcd, e);
+        if (f == *g_nat_mod) return reduce_bin_nat_op(*g_nat_mod, nat_mod, e);
+        if (f == *g_nat_div) return reduce_bin_nat_op(*g_nat_div, nat_div, e);
         if (f == *g_nat_beq) return reduce_bin_nat_pred(nat_eq, e);
         if (f == *g_nat_ble) return reduce_bin_nat_pred(nat_le, e);
-        if (f == *g_nat_land) return reduce_bin_nat_op(nat_land, e);
-        if (f == *g_nat_lor)  return reduce_bin_nat_op(nat_lor, e);
-        if (f == *g_nat_xor)  return reduce_bin_nat_op(nat_lxor, e);
-        if (f == *g_nat_shiftLeft) return reduce_bin_nat_op(lean_nat_shiftl, e);
-        if (f == *g_nat_shiftRight) return reduce_bin_nat_op(lean_nat_shiftr, e);
+        if (f == *g_nat_land) return reduce_bin_nat_op(*g_nat_land, nat_land, e);
+        if (f == *g_nat_lor)  return reduce_bin_nat_op(*g_nat_lor, nat_lor, e);
+        if (f == *g_nat_xor)  return reduce_bin_nat_op(*g_nat_xor, nat_lxor, e);
+        if (f == *g_nat_shiftLeft) return reduce_bin_nat_op(*g_nat_shiftLeft, lean_nat_shiftl, e);
+        if (f == *g_nat_shiftRight) return reduce_bin_nat_op(*g_nat_shiftRight, lean_nat_shiftr, e);
     }
     return none_expr();
 }
@@ -659,7 +757,7 @@ expr type_checker::whnf(expr const & e) {
     case expr_kind::MData:
         return whnf(mdata_expr(e));
     case expr_kind::FVar:
-        if (is_let_fvar(m_lctx, e))
+        if (is_let_fvar(e))
             break;
         else
             return e;
@@ -702,7 +800,7 @@ expr type_checker::whnf(expr const & e) {
 bool type_checker::is_def_eq_binding(expr t, expr s) {
     lean_assert(t.kind() == s.kind());
     lean_assert(is_binding(t));
-    flet<local_ctx> save_lctx(m_lctx, m_lctx);
+    lctx_scope save_lctx(*this);
     expr_kind k = t.kind();
     buffer<expr> subst;
     do {
@@ -717,7 +815,7 @@ bool type_checker::is_def_eq_binding(expr t, expr s) {
             // free variable is used inside t or s
             if (!var_s_type)
                 var_s_type = instantiate_rev(binding_domain(s), subst.size(), subst.data());
-            subst.push_back(m_lctx.mk_local_decl(m_st->m_ngen, binding_name(s), *var_s_type, binding_info(s)));
+            subst.push_back(mk_local_decl(binding_name(s), *var_s_type, binding_info(s)));
         } else {
             subst.push_back(*g_dont_care); // don't care
         }
@@ -750,8 +848,11 @@ bool type_checker::is_def_eq(levels const & ls1, levels const & ls2) {
 
 /** \brief This is an auxiliary method for is_def_eq. It handles the "easy cases". */
 lbool type_checker::quick_is_def_eq(expr const & t, expr const & s, bool use_hash) {
-    if (m_st->m_eqv_manager.is_equiv(t, s, use_hash))
+    if (m_st->m_eqv_manager.is_equiv(t, s, use_hash)) {
+        if (m_diag)
+            m_diag->get_def_eq_stats().m_eqv_cache_hit++;
         return l_true;
+    }
     if (t.kind() == s.kind()) {
         switch (t.kind()) {
         case expr_kind::Lambda: case expr_kind::Pi:
@@ -855,18 +956,24 @@ lbool type_checker::is_def_eq_proof_irrel(expr const & t, expr const & s) {
 }
 
 bool type_checker::failed_before(expr const & t, expr const & s) const {
+    bool r;
     if (hash(t) < hash(s)) {
-        return m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end();
+        r = m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end();
     } else if (hash(t) > hash(s)) {
-        return m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
+        r = m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
     } else {
-        return
+        r =
             m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end() ||
             m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
     }
+    if (r && m_diag)
+        m_diag->get_def_eq_stats().m_failure_cache_hit++;
+    return r;
 }
 
 void type_checker::cache_failure(expr const & t, expr const & s) {
+    if (m_diag)
+        m_diag->get_def_eq_stats().m_failure_cached++;
     if (hash(t) <= hash(s))
         m_st->m_failure.insert(mk_pair(t, s));
     else
@@ -894,6 +1001,8 @@ optional<expr> type_checker::try_unfold_proj_app(expr const & e) {
 
      \remark t_n, s_n and cs are updated. */
 auto type_checker::lazy_delta_reduction_step(expr & t_n, expr & s_n) -> reduction_status {
+    if (m_diag)
+        m_diag->get_def_eq_stats().m_lazy_delta_step++;
     auto d_t = is_delta(t_n);
     auto d_s = is_delta(s_n);
     if (!d_t && !d_s) {
@@ -981,11 +1090,39 @@ lbool type_checker::is_def_eq_offset(expr const & t, expr const & s) {
     return l_undef;
 }
 
+/*
+Add the time spent in the outermost of nested scopes sharing `depth` to `*us`, unless `us` is `nullptr`.
+Used for the statistics of `is_def_eq`, see `def_eq_stats`.
+*/
+class def_eq_timer {
+    uint64 *                          m_us;
+    unsigned &                        m_depth;
+    chrono::steady_clock::time_point  m_start;
+public:
+    def_eq_timer(uint64 * us, unsigned & depth):m_us(depth == 0 ? us : nullptr), m_depth(depth) {
+        if (m_us)
+            m_start = chrono::steady_clock::now();
+        m_depth++;
+    }
+    ~def_eq_timer() {
+        m_depth--;
+        if (m_us)
+            *m_us += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - m_start).count();
+    }
+};
+
 /** \remark t_n, s_n are updated. */
 lbool type_checker::lazy_delta_reduction(expr & t_n, expr & s_n) {
+    if (m_diag)
+        m_diag->get_def_eq_stats().m_lazy_delta++;
+    def_eq_timer timer(m_diag ? &m_diag->get_def_eq_stats().m_lazy_delta_us : nullptr, m_lazy_delta_depth);
     while (true) {
         lbool r = is_def_eq_offset(t_n, s_n);
-        if (r != l_undef) return r;
+        if (r != l_undef) {
+            if (m_diag)
+                m_diag->get_def_eq_stats().m_offset++;
+            return r;
+        }
 
         if (!has_fvar(t_n) && !has_fvar(s_n)) {
             if (auto t_v = reduce_nat(t_n)) {
@@ -1067,9 +1204,16 @@ bool type_checker::is_def_eq_unit_like(expr const & t, expr const & s) {
 
 bool type_checker::is_def_eq_core(expr const & t, expr const & s) {
     check_system("is_definitionally_equal", /* do_check_interrupted */ true);
+    if (m_diag)
+        m_diag->get_def_eq_stats().m_is_def_eq++;
+    def_eq_timer timer(m_diag ? &m_diag->get_def_eq_stats().m_is_def_eq_us : nullptr, m_is_def_eq_depth);
     bool use_hash = true;
     lbool r = quick_is_def_eq(t, s, use_hash);
-    if (r != l_undef) return r == l_true;
+    if (r != l_undef) {
+        if (m_diag)
+            m_diag->get_def_eq_stats().m_quick++;
+        return r == l_true;
+    }
 
     // Very basic support for proofs by reflection. If `t` has no free variables and `s` is `Bool.true`,
     // we fully reduce `t` and check whether result is `s`.
@@ -1097,7 +1241,11 @@ bool type_checker::is_def_eq_core(expr const & t, expr const & s) {
     }
 
     r = is_def_eq_proof_irrel(t_n, s_n);
-    if (r != l_undef) return r == l_true;
+    if (r != l_undef) {
+        if (m_diag)
+            m_diag->get_def_eq_stats().m_proof_irrel++;
+        return r == l_true;
+    }
 
     /* NB: `lazy_delta_reduction` updates `t_n` and `s_n` even when returning `l_undef`. */
     r = lazy_delta_reduction(t_n, s_n);
@@ -1130,8 +1278,11 @@ bool type_checker::is_def_eq_core(expr const & t, expr const & s) {
     if (try_eta_expansion(t_n, s_n))
         return true;
 
-    if (try_eta_struct(t_n, s_n))
+    if (try_eta_struct(t_n, s_n)) {
+        if (m_diag)
+            m_diag->get_def_eq_stats().m_eta_struct++;
         return true;
+    }
 
     r = try_string_lit_expansion(t_n, s_n);
     if (r != l_undef) return r == l_true;
@@ -1151,11 +1302,11 @@ bool type_checker::is_def_eq(expr const & t, expr const & s) {
 
 expr type_checker::eta_expand(expr const & e) {
     buffer<expr> fvars;
-    flet<local_ctx> save_lctx(m_lctx, m_lctx);
+    lctx_scope save_lctx(*this);
     expr it = e;
     while (is_lambda(it)) {
         expr d = instantiate_rev(binding_domain(it), fvars.size(), fvars.data());
-        fvars.push_back(m_lctx.mk_local_decl(m_st->m_ngen, binding_name(it), d, binding_info(it)));
+        fvars.push_back(mk_local_decl(binding_name(it), d, binding_info(it)));
         it     = binding_body(it);
     }
     it = instantiate_rev(it, fvars.size(), fvars.data());
@@ -1163,7 +1314,7 @@ expr type_checker::eta_expand(expr const & e) {
     if (!is_pi(it_type)) return e;
     buffer<expr> args;
     while (is_pi(it_type)) {
-        expr arg = m_lctx.mk_local_decl(m_st->m_ngen, binding_name(it_type), binding_domain(it_type), binding_info(it_type));
+        expr arg = mk_local_decl(binding_name(it_type), binding_domain(it_type), binding_info(it_type));
         args.push_back(arg);
         fvars.push_back(arg);
         it_type  = whnf(instantiate(binding_body(it_type), arg));
@@ -1184,6 +1335,7 @@ type_checker::type_checker(state & st, local_ctx const & lctx, definition_safety
 
 type_checker::type_checker(type_checker && src):
     m_st_owner(src.m_st_owner), m_st(src.m_st), m_diag(src.m_diag), m_lctx(std::move(src.m_lctx)),
+    m_fvar_decls(std::move(src.m_fvar_decls)), m_fvar_base(src.m_fvar_base), m_lctx_decls(std::move(src.m_lctx_decls)),
     m_definition_safety(src.m_definition_safety), m_lparams(src.m_lparams) {
     src.m_st_owner = false;
 }
@@ -1221,6 +1373,7 @@ void initialize_type_checker() {
     g_nat_xor      = new_persistent_expr_const({"Nat", "xor"});
     g_nat_shiftLeft  = new_persistent_expr_const({"Nat", "shiftLeft"});
     g_nat_shiftRight = new_persistent_expr_const({"Nat", "shiftRight"});
+    g_nat_log2     = new_persistent_expr_const({"Nat", "log2"});
     g_string_mk    = new_persistent_expr_const({"String", "mk"});
     g_lean_reduce_bool = new_persistent_expr_const({"theorem_ai", "reduceBool"});
     g_lean_reduce_nat  = new_persistent_expr_const({"theorem_ai", "reduceNat"});
@@ -1247,6 +1400,7 @@ void finalize_type_checker() {
     delete g_nat_xor;
     delete g_nat_shiftLeft;
     delete g_nat_shiftRight;
+    delete g_nat_log2;
     delete g_string_mk;
     delete g_lean_reduce_bool;
     delete g_lean_reduce_nat;
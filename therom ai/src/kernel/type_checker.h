@@ -6,10 +6,13 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <unordered_set>
+#include <unordered_map>
 #include <memory>
 #include <utility>
+#include <vector>
 #include <algorithm>
 #include "runtime/flet.h"
+#include "runtime/hash.h"
 #include "util/lbool.h"
 #include "util/name_set.h"
 #include "util/name_generator.h"
@@ -26,6 +29,28 @@ public:
     class state {
         typedef expr_map<expr> infer_cache;
         typedef std::unordered_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_set;
+        /* Key of the cache of `Nat` operations on big literals: the operation and the literals it is applied to. */
+        struct nat_lit_key {
+            lean_object * m_op;
+            lean_object * m_arg1;
+            lean_object * m_arg2;
+            bool operator==(nat_lit_key const & k) const {
+                return m_op == k.m_op && m_arg1 == k.m_arg1 && m_arg2 == k.m_arg2;
+            }
+        };
+        struct nat_lit_key_hash {
+            size_t operator()(nat_lit_key const & k) const {
+                auto h = [](lean_object * o) { return static_cast<uint64>(reinterpret_cast<size_t>(o) >> 3); };
+                return static_cast<size_t>(hash(hash(h(k.m_op), h(k.m_arg1)), h(k.m_arg2)));
+            }
+        };
+        /* The literals are stored with the result to keep the pointers of the key alive. */
+        struct nat_lit_entry {
+            expr m_arg1;
+            expr m_arg2;
+            expr m_result;
+        };
+        typedef std::unordered_map<nat_lit_key, nat_lit_entry, nat_lit_key_hash> nat_lit_cache;
         environment               m_env;
         name_generator            m_ngen;
         infer_cache               m_infer_type[2];
@@ -33,6 +58,7 @@ public:
         expr_map<expr>            m_whnf;
         equiv_manager             m_eqv_manager;
         expr_pair_set             m_failure;
+        nat_lit_cache             m_nat_lit;
         friend type_checker;
     public:
         state(environment const & env);
@@ -44,12 +70,29 @@ private:
     bool                      m_st_owner;
     state *                   m_st;
     diagnostics *             m_diag;
+    /* Nesting depth of `is_def_eq_core` and `lazy_delta_reduction`, for timing only the outermost calls. */
+    unsigned                  m_is_def_eq_depth{0};
+    unsigned                  m_lazy_delta_depth{0};
     local_ctx                 m_lctx;
+    /* Local declarations of the free variables created by this type checker, indexed by the numeral of their
+       name in `m_st->m_ngen` minus `m_fvar_base`, so that they are found without searching `m_lctx`. They are
+       still added to `m_lctx`, which is used to abstract them and to report errors. */
+    std::vector<local_decl>   m_fvar_decls;
+    unsigned                  m_fvar_base{0};
+    /* Local declarations of the free variables of the local context given to the constructor, cached by name. */
+    std::unordered_map<name, local_decl, name_hash_fn> m_lctx_decls;
     definition_safety         m_definition_safety;
     /* When `m_lparams != nullptr, the `check` method makes sure all level parameters
        are in `m_lparams`. */
     names const *             m_lparams;
 
+    class lctx_scope;
+    expr push_local_decl(local_decl const & d);
+    expr mk_local_decl(name const & un, expr const & type, binder_info bi);
+    expr mk_local_decl(name const & un, expr const & type, expr const & value);
+    optional<local_decl> find_local_decl(expr const & e);
+    bool is_let_fvar(expr const & e);
+
     expr ensure_sort_core(expr e, expr const & s);
     expr ensure_pi_core(expr e, expr const & s);
     void check_level(level const & l);
@@ -100,7 +143,7 @@ private:
     expr check_ignore_undefined_universes(expr const & e);
     optional<expr> try_unfold_proj_app(expr const & e);
 
-    template<typename F> optional<expr> reduce_bin_nat_op(F const & f, expr const & e);
+    template<typename F> optional<expr> reduce_bin_nat_op(expr const & op, F const & f, expr const & e);
     template<typename F> optional<expr> reduce_bin_nat_pred(F const & f, expr const & e);
     optional<expr> reduce_pow(expr const & e);
     optional<expr> reduce_nat(expr const & e);
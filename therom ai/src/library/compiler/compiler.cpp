@@ -4,9 +4,21 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "runtime/alloc.h"
+#include "runtime/interrupt.h"
 #include "util/option_declarations.h"
 #include "util/io.h"
+#include "kernel/expr_size.h"
 #include "kernel/type_checker.h"
+#include "kernel/equiv_manager.h"
 #include "kernel/kernel_exception.h"
 #include "kernel/trace.h"
 #include "library/max_sharing.h"
@@ -34,6 +46,9 @@ Author: Leonardo de Moura
 
 namespace theorem_ai {
 static name * g_extract_closed = nullptr;
+static name * g_compiler_parallel = nullptr;
+static name * g_compiler_pass_stats = nullptr;
+static mutex * g_pass_stats_mutex = nullptr;
 
 bool is_extract_closed_enabled(options const & opts) { return opts.get_bool(*g_extract_closed, true); }
 
@@ -65,6 +80,174 @@ comp_decls apply(F && f, comp_decls const & ds) {
     return map(ds, [&](comp_decl const & d) { return comp_decl(d.fst(), f(d.snd())); });
 }
 
+/* Parallel code generation.
+
+   The passes applied to each declaration of a group separately only read the environment and create fresh names with
+   name generators local to the declaration, so they can run on the declarations of a group (mutual blocks, and the
+   auxiliary declarations created by specialization and lambda lifting) in parallel. Results are collected in the
+   original order, so the output does not depend on the scheduling. The tasks run with the heartbeats, heartbeat limit,
+   and cancel token of the compiling thread. Passes that extend the environment stay sequential. */
+struct par_apply_job {
+    std::function<expr(expr const &)> m_fn;
+    std::vector<expr>                 m_inputs;
+    std::vector<std::exception_ptr>   m_errors;
+    interrupt_state                   m_interrupt;
+};
+
+static obj_res par_apply_task_fn(obj_arg job, obj_arg i, obj_arg) {
+    par_apply_job & j = *reinterpret_cast<par_apply_job *>(unbox_size_t(job));
+    size_t idx = unbox(i);
+    dec(job);
+    scope_interrupt_state scope(j.m_interrupt);
+    object * r;
+    try {
+        r = j.m_fn(j.m_inputs[idx]).steal();
+    } catch (...) {
+        j.m_errors[idx] = std::current_exception();
+        r = box(0);
+    }
+    // the worker thread may not type check again for a long time
+    equiv_manager::clear_persistent();
+    return r;
+}
+
+/* Like `apply`, but runs `f` on several declarations in parallel if `parallel` is true. */
+template<typename F>
+comp_decls par_apply(F && f, elab_environment const & env, comp_decls const & ds, bool parallel) {
+    // traces are collected by thread, so we would lose them in the tasks
+    if (!parallel || length(ds) < 2 || is_trace_enabled()) {
+        return apply(f, env, ds);
+    }
+    par_apply_job job;
+    job.m_fn = [&](expr const & e) { return f(env, e); };
+    // the tasks share the environment and the inputs
+    mark_mt(env.raw());
+    for (comp_decl const & d : ds) {
+        mark_mt(d.snd().raw());
+        job.m_inputs.push_back(d.snd());
+    }
+    job.m_errors.resize(job.m_inputs.size());
+    job.m_interrupt = capture_interrupt_state();
+    std::vector<object_ref> tasks;
+    for (size_t i = 0; i < job.m_inputs.size(); i++) {
+        object * c = alloc_closure(par_apply_task_fn, 2);
+        closure_set(c, 0, box_size_t(reinterpret_cast<size_t>(&job)));
+        closure_set(c, 1, box(i));
+        tasks.push_back(object_ref(task_spawn(c)));
+    }
+    buffer<comp_decl> r;
+    size_t i = 0;
+    for (comp_decl const & d : ds) {
+        expr v(task_get(tasks[i].raw()), true);
+        // wait for all tasks before rethrowing, as they reference `job`
+        r.push_back(comp_decl(d.fst(), v));
+        i++;
+    }
+    for (std::exception_ptr const & ex : job.m_errors) {
+        if (ex) {
+            std::rethrow_exception(ex);
+        }
+    }
+    return comp_decls(r);
+}
+
+/* Per-pass statistics.
+
+   If `compiler.pass_stats` is set to a file name, `compile` records, for each pass, its wall time, the number of
+   small object allocations it performed (as counted by the heartbeat), and the size of the declarations before and
+   after it. The result is appended to the file as one JSON object per line and compiled group:
+
+   {"decls": ["f", "g"], "passes": [{"pass": "csimp", "time_ms": 0.52, "allocs": 1234, "size_before": 310, "size_after": 187}, ...]}
+
+   The size is the number of distinct subterms. Passes run sequentially in this mode, so that their allocations
+   happen on the current thread. `tests/bench/compiler_passes.py` aggregates these files and compares them. */
+static size_t get_num_nodes(comp_decls const & ds) {
+    size_t r = 0;
+    for (comp_decl const & d : ds)
+        r += get_dag_size(d.snd());
+    return r;
+}
+
+static void display_json_string(std::ostream & out, std::string const & s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+            out << buf;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+class pass_stats {
+    struct entry {
+        char const * m_pass;
+        double       m_time_ms;
+        uint64_t     m_allocs;
+        size_t       m_size_before;
+        size_t       m_size_after;
+    };
+    std::string        m_file;
+    names              m_decls;
+    std::vector<entry> m_entries;
+public:
+    pass_stats(options const & opts, names const & decls):
+        m_file(opts.get_string(*g_compiler_pass_stats, "")), m_decls(decls) {}
+
+    bool enabled() const { return !m_file.empty(); }
+
+    /* Run `fn`, which updates `ds`, and record it as `pass`. */
+    template<typename F> void run(char const * pass, comp_decls const & ds, F && fn) {
+        if (!enabled()) {
+            fn();
+            return;
+        }
+        entry e;
+        e.m_pass        = pass;
+        e.m_size_before = get_num_nodes(ds);
+        uint64_t allocs = get_num_heartbeats();
+        auto start      = std::chrono::steady_clock::now();
+        fn();
+        auto end        = std::chrono::steady_clock::now();
+        e.m_allocs      = get_num_heartbeats() - allocs;
+        e.m_time_ms     = std::chrono::duration<double, std::milli>(end - start).count();
+        e.m_size_after  = get_num_nodes(ds);
+        m_entries.push_back(e);
+    }
+
+    /* Append the statistics recorded so far to the output file. */
+    void flush() {
+        if (!enabled() || m_entries.empty())
+            return;
+        std::ostringstream out;
+        out << "{\"decls\": [";
+        bool first = true;
+        for (name const & n : m_decls) {
+            if (!first) out << ", ";
+            display_json_string(out, n.to_string());
+            first = false;
+        }
+        out << "], \"passes\": [";
+        for (size_t i = 0; i < m_entries.size(); i++) {
+            entry const & e = m_entries[i];
+            if (i > 0) out << ", ";
+            out << "{\"pass\": \"" << e.m_pass << "\", \"time_ms\": " << e.m_time_ms
+                << ", \"allocs\": " << e.m_allocs << ", \"size_before\": " << e.m_size_before
+                << ", \"size_after\": " << e.m_size_after << "}";
+        }
+        out << "]}\n";
+        m_entries.clear();
+        // groups may be compiled concurrently
+        lock_guard<mutex> _(*g_pass_stats_mutex);
+        std::ofstream(m_file, std::ios::app) << out.str();
+    }
+};
+
 void trace_comp_decl(comp_decl const & d) {
     tout() << ">> " << d.fst() << "\n" << trace_pp_expr(d.snd()) << "\n";
 }
@@ -204,24 +387,26 @@ elab_environment compile(elab_environment const & env, options const & opts, nam
     // scope_traces_as_string trace_scope;
     auto simp  = [&](elab_environment const & env, expr const & e) { return csimp(env, e, cfg); };
     auto esimp = [&](elab_environment const & env, expr const & e) { return cesimp(env, e, cfg); };
+    pass_stats stats(opts, cs);
+    bool par = opts.get_bool(*g_compiler_parallel, true) && !stats.enabled();
     trace_compiler(name({"compiler", "input"}), ds);
-    ds = apply(eta_expand, env, ds);
+    stats.run("eta_expand", ds, [&]() { ds = apply(eta_expand, env, ds); });
     trace_compiler(name({"compiler", "eta_expand"}), ds);
-    ds = apply(to_lcnf, env, ds);
-    ds = apply(find_jp, env, ds);
+    stats.run("to_lcnf", ds, [&]() { ds = par_apply(to_lcnf, env, ds, par); });
+    stats.run("find_jp", ds, [&]() { ds = apply(find_jp, env, ds); });
     // trace(ds);
     trace_compiler(name({"compiler", "lcnf"}), ds);
     // trace(ds);
-    ds = apply(cce, env, ds);
+    stats.run("cce", ds, [&]() { ds = par_apply(cce, env, ds, par); });
     trace_compiler(name({"compiler", "cce"}), ds);
-    ds = apply(csimp_replace_constants, env, ds);
-    ds = apply(simp, env, ds);
+    stats.run("csimp_replace_constants", ds, [&]() { ds = apply(csimp_replace_constants, env, ds); });
+    stats.run("csimp", ds, [&]() { ds = par_apply(simp, env, ds, par); });
     trace_compiler(name({"compiler", "simp"}), ds);
     // trace(ds);
     elab_environment new_env = env;
-    std::tie(new_env, ds) = eager_lambda_lifting(new_env, ds, cfg);
+    stats.run("eager_lambda_lifting", ds, [&]() { std::tie(new_env, ds) = eager_lambda_lifting(new_env, ds, cfg); });
     trace_compiler(name({"compiler", "eager_lambda_lifting"}), ds);
-    ds = apply(max_sharing, ds);
+    stats.run("max_sharing", ds, [&]() { ds = apply(max_sharing, ds); });
     trace_compiler(name({"compiler", "stage1"}), ds);
     new_env = cache_stage1(new_env, ds);
     if (is_matcher(new_env, ds)) {
@@ -231,44 +416,46 @@ elab_environment compile(elab_environment const & env, options const & opts, nam
 
            TODO: we should have a "[strong_inline]" annotation that will inline a definition even
            when it is partially applied. Then, we can mark all `match` auxiliary functions as `[strong_inline]` */
+        stats.flush();
         return new_env;
     }
-    std::tie(new_env, ds) = specialize(new_env, ds, cfg);
+    stats.run("specialize", ds, [&]() { std::tie(new_env, ds) = specialize(new_env, ds, cfg); });
     // The following check is incorrect. It was exposed by issue #1812.
     // We will not fix the check since we will delete the compiler.
     // lean_assert(lcnf_check_let_decls(new_env, ds));
     trace_compiler(name({"compiler", "specialize"}), ds);
-    ds = apply(elim_dead_let, ds);
+    stats.run("elim_dead_let", ds, [&]() { ds = apply(elim_dead_let, ds); });
     trace_compiler(name({"compiler", "elim_dead_let"}), ds);
-    ds = apply(erase_irrelevant, new_env, ds);
+    stats.run("erase_irrelevant", ds, [&]() { ds = par_apply(erase_irrelevant, new_env, ds, par); });
     trace_compiler(name({"compiler", "erase_irrelevant"}), ds);
-    ds = apply(struct_cases_on, new_env, ds);
+    stats.run("struct_cases_on", ds, [&]() { ds = par_apply(struct_cases_on, new_env, ds, par); });
     trace_compiler(name({"compiler", "struct_cases_on"}), ds);
-    ds = apply(esimp, new_env, ds);
+    stats.run("cesimp", ds, [&]() { ds = par_apply(esimp, new_env, ds, par); });
     trace_compiler(name({"compiler", "simp"}), ds);
-    ds = reduce_arity(new_env, ds);
+    stats.run("reduce_arity", ds, [&]() { ds = reduce_arity(new_env, ds); });
     trace_compiler(name({"compiler", "reduce_arity"}), ds);
-    std::tie(new_env, ds) = lambda_lifting(new_env, ds);
+    stats.run("lambda_lifting", ds, [&]() { std::tie(new_env, ds) = lambda_lifting(new_env, ds); });
     trace_compiler(name({"compiler", "lambda_lifting"}), ds);
     // trace(ds);
-    ds = apply(esimp, new_env, ds);
+    stats.run("cesimp", ds, [&]() { ds = par_apply(esimp, new_env, ds, par); });
     trace_compiler(name({"compiler", "simp"}), ds);
     new_env = cache_stage2(new_env, ds);
     trace_compiler(name({"compiler", "stage2"}), ds);
     if (is_extract_closed_enabled(opts)) {
-        std::tie(new_env, ds) = extract_closed(new_env, ds);
-        ds = apply(elim_dead_let, ds);
-        ds = apply(esimp, new_env, ds);
+        stats.run("extract_closed", ds, [&]() { std::tie(new_env, ds) = extract_closed(new_env, ds); });
+        stats.run("elim_dead_let", ds, [&]() { ds = apply(elim_dead_let, ds); });
+        stats.run("cesimp", ds, [&]() { ds = par_apply(esimp, new_env, ds, par); });
         trace_compiler(name({"compiler", "extract_closed"}), ds);
     }
     new_env = cache_new_stage2(new_env, ds);
-    ds = apply(esimp, new_env, ds);
+    stats.run("cesimp", ds, [&]() { ds = par_apply(esimp, new_env, ds, par); });
     trace_compiler(name({"compiler", "simp"}), ds);
-    ds = apply(simp_app_args, new_env, ds);
-    ds = apply(ecse, new_env, ds);
-    ds = apply(elim_dead_let, ds);
+    stats.run("simp_app_args", ds, [&]() { ds = par_apply(simp_app_args, new_env, ds, par); });
+    stats.run("ecse", ds, [&]() { ds = par_apply(ecse, new_env, ds, par); });
+    stats.run("elim_dead_let", ds, [&]() { ds = apply(elim_dead_let, ds); });
     trace_compiler(name({"compiler", "simp_app_args"}), ds);
     // std::cout << trace_scope.get_string() << "\n";
+    stats.flush();
     /* compile IR. */
     return compile_ir(new_env, opts, ds);
 }
@@ -283,6 +470,13 @@ void initialize_compiler() {
     g_extract_closed = new name{"compiler", "extract_closed"};
     mark_persistent(g_extract_closed->raw());
     register_bool_option(*g_extract_closed, true, "(compiler) enable/disable closed term caching");
+    g_compiler_parallel = new name{"compiler", "parallel"};
+    mark_persistent(g_compiler_parallel->raw());
+    register_bool_option(*g_compiler_parallel, true, "(compiler) run the passes that transform each declaration of a group separately on several declarations in parallel");
+    g_compiler_pass_stats = new name{"compiler", "pass_stats"};
+    mark_persistent(g_compiler_pass_stats->raw());
+    register_string_option(*g_compiler_pass_stats, "", "(compiler) file to append the wall time, allocations and code size of each compiler pass to, as one JSON object per compiled group; disables `compiler.parallel`");
+    g_pass_stats_mutex = new mutex;
     register_trace_class("compiler");
     register_trace_class({"compiler", "input"});
     register_trace_class({"compiler", "inline"});
@@ -292,6 +486,7 @@ void initialize_compiler() {
     register_trace_class({"compiler", "simp"});
     register_trace_class({"compiler", "simp_detail"});
     register_trace_class({"compiler", "simp_float_cases"});
+    register_trace_class({"compiler", "simp_stats"});
     register_trace_class({"compiler", "elim_dead_let"});
     register_trace_class({"compiler", "cse"});
     register_trace_class({"compiler", "specialize"});
@@ -324,6 +519,9 @@ void initialize_compiler() {
 }
 
 void finalize_compiler() {
+    delete g_pass_stats_mutex;
+    delete g_compiler_pass_stats;
+    delete g_compiler_parallel;
     delete g_extract_closed;
 }
 }
@@ -20,6 +20,7 @@ Author: Leonardo de Moura
 #include "library/constants.h"
 #include "library/class.h"
 #include "library/expr_pair_maps.h"
+#include "library/max_sharing.h"
 #include "library/compiler/util.h"
 #include "library/compiler/cse.h"
 #include "library/compiler/elim_dead_let.h"
@@ -29,6 +30,33 @@ Author: Leonardo de Moura
 #include "library/compiler/init_attribute.h"
 
 namespace theorem_ai {
+/* Hit and miss counts of the memo tables of `csimp_fn`, reported by the trace class `compiler.simp_stats`. */
+struct csimp_stats {
+    unsigned m_iterations{0};
+    unsigned m_infer_hits{0};
+    unsigned m_infer_misses{0};
+    unsigned m_whnf_type_hits{0};
+    unsigned m_whnf_type_misses{0};
+    unsigned m_size_hits{0};
+    unsigned m_size_misses{0};
+    unsigned m_jp_hits{0};
+    unsigned m_jp_misses{0};
+    unsigned m_simplified_hits{0};
+};
+
+static std::ostream & operator<<(std::ostream & out, csimp_stats const & s) {
+    auto rate = [&](char const * what, unsigned hits, unsigned misses) {
+        out << "  " << what << ": " << hits << "/" << hits + misses << " hits\n";
+    };
+    out << "iterations: " << s.m_iterations << "\n";
+    rate("infer_type", s.m_infer_hits, s.m_infer_misses);
+    rate("whnf_infer_type", s.m_whnf_type_hits, s.m_whnf_type_misses);
+    rate("lcnf_size", s.m_size_hits, s.m_size_misses);
+    rate("join_point", s.m_jp_hits, s.m_jp_misses);
+    out << "  already_simplified: " << s.m_simplified_hits << " hits\n";
+    return out;
+}
+
 csimp_cfg::csimp_cfg(options const &):
     csimp_cfg() {
 }
@@ -96,6 +124,13 @@ class csimp_fn {
        We use this information to reduce nested cases_on applications and projections. */
     typedef rb_expr_map<expr> expr2ctor;
     expr2ctor                m_expr2ctor;
+    /* Memo tables for the types and LCNF sizes of subterms. They are kept across the iterations of `csimp_core`,
+       which (using `max_sharing`) makes sure identical subterms are pointer equal, so lookups are cheap.
+       Types only depend on the local declarations of free variables, which are never updated. */
+    expr_map<expr>           m_infer_cache;
+    expr_map<expr>           m_whnf_type_cache;
+    expr_map<unsigned>       m_size_cache;
+    csimp_stats &            m_stats;
 
     elab_environment const & env() const { return m_env; }
 
@@ -166,8 +201,25 @@ class csimp_fn {
         m_simplified.insert(e);
     }
 
-    bool already_simplified(expr const & e) const {
-        return m_simplified.find(e) != m_simplified.end();
+    bool already_simplified(expr const & e) {
+        if (m_simplified.find(e) == m_simplified.end())
+            return false;
+        m_stats.m_simplified_hits++;
+        return true;
+    }
+
+    unsigned lcnf_size(expr const & e) {
+        if (!is_let(e) && !is_lambda(e) && !is_app(e))
+            return 1;
+        auto it = m_size_cache.find(e);
+        if (it != m_size_cache.end()) {
+            m_stats.m_size_hits++;
+            return it->second;
+        }
+        m_stats.m_size_misses++;
+        unsigned r = get_lcnf_size(env(), e);
+        m_size_cache.insert(mk_pair(e, r));
+        return r;
     }
 
     bool is_join_point_app(expr const & e) const {
@@ -178,11 +230,11 @@ class csimp_fn {
             is_join_point_name(m_lctx.get_local_decl(fn).get_user_name());
     }
 
-    bool is_small_join_point(expr const & e) const {
-        return get_lcnf_size(env(), e) <= m_cfg.m_inline_jp_threshold;
+    bool is_small_join_point(expr const & e) {
+        return lcnf_size(e) <= m_cfg.m_inline_jp_threshold;
     }
 
-    expr find(expr const & e, bool skip_mdata = true, bool use_expr2ctor = false) const {
+    expr find(expr const & e, bool skip_mdata = true, bool use_expr2ctor = false) {
         if (use_expr2ctor) {
             if (expr const * ctor = m_expr2ctor.find(e)) {
                 return *ctor;
@@ -207,7 +259,7 @@ class csimp_fn {
         return e;
     }
 
-    expr find_ctor(expr const & e) const {
+    expr find_ctor(expr const & e) {
         return find(e, true, true);
     }
 
@@ -217,10 +269,17 @@ class csimp_fn {
     }
 
     expr infer_type(expr const & e) {
-        if (m_before_erasure)
-            return type_checker(m_st, m_lctx).infer(e);
-        else
+        if (!m_before_erasure)
             return mk_enf_object_type();
+        auto it = m_infer_cache.find(e);
+        if (it != m_infer_cache.end()) {
+            m_stats.m_infer_hits++;
+            return it->second;
+        }
+        m_stats.m_infer_misses++;
+        expr r = type_checker(m_st, m_lctx).infer(e);
+        m_infer_cache.insert(mk_pair(e, r));
+        return r;
     }
 
     expr whnf(expr const & e) {
@@ -230,8 +289,15 @@ class csimp_fn {
 
     expr whnf_infer_type(expr const & e) {
         lean_assert(m_before_erasure);
-        type_checker tc(m_st, m_lctx);
-        return tc.whnf(tc.infer(e));
+        auto it = m_whnf_type_cache.find(e);
+        if (it != m_whnf_type_cache.end()) {
+            m_stats.m_whnf_type_hits++;
+            return it->second;
+        }
+        m_stats.m_whnf_type_misses++;
+        expr r = whnf(infer_type(e));
+        m_whnf_type_cache.insert(mk_pair(e, r));
+        return r;
     }
 
     optional<expr> whnf_infer_type_guarded(expr const & e) {
@@ -381,7 +447,7 @@ class csimp_fn {
        Remark: it may produce type incorrect terms. */
     expr mk_join_point_float_cases_on(expr const & fvar, expr const & e, expr const & c) {
         lean_assert(is_cases_on_app(env(), c));
-        unsigned e_size = get_lcnf_size(env(), e);
+        unsigned e_size = lcnf_size(e);
         if (e_size == 1) {
             return e;
         }
@@ -409,7 +475,7 @@ class csimp_fn {
                 std::tie(begin_minors, end_minors) = get_cases_on_minors_range(env(), const_name(fn), m_before_erasure);
                 for (unsigned minor_idx = begin_minors; minor_idx < end_minors; minor_idx++) {
                     expr minor = args[minor_idx];
-                    if (get_lcnf_size(env(), minor) > branch_threshold) {
+                    if (lcnf_size(minor) > branch_threshold) {
                         buffer<bool> used_zs; /* used_zs[i] iff `minor` uses `zs[i]` */
                         bool         used_fvar = false; /* true iff `minor` uses `fvar` */
                         bool         used_unit = false; /* true if we needed to add `unit ->` to joint point */
@@ -538,8 +604,11 @@ class csimp_fn {
     expr mk_new_join_point(expr const & x, expr const & e, expr const & jp) {
         expr_pair key = mk_jp_cache_key(x, e, jp);
         auto it = m_jp_cache.find(key);
-        if (it != m_jp_cache.end())
+        if (it != m_jp_cache.end()) {
+            m_stats.m_jp_hits++;
             return it->second;
+        }
+        m_stats.m_jp_misses++;
         local_decl jp_decl = m_lctx.get_local_decl(jp);
         lean_assert(is_join_point_name(jp_decl.get_user_name()));
         expr jp_val = *jp_decl.get_value();
@@ -1742,7 +1811,7 @@ class csimp_fn {
             bool inline_attr           = has_inline_attribute(env(), const_name(fn));
             bool inline_if_reduce_attr = has_inline_if_reduce_attribute(env(), const_name(fn));
             if (!inline_attr && !inline_if_reduce_attr &&
-                (get_lcnf_size(env(), info->get_value()) > m_cfg.m_inline_threshold ||
+                (lcnf_size(info->get_value()) > m_cfg.m_inline_threshold ||
                  is_constant(e))) { /* We only inline constants if they are marked with the `[inline]` or `[inline_if_reduce]` attrs */
                 return none_expr();
             }
@@ -1768,7 +1837,7 @@ class csimp_fn {
             if (!info || !info->is_definition()) return none_expr();
             unsigned arity = get_num_nested_lambdas(info->get_value());
             if (get_app_num_args(e) < arity || arity == 0) return none_expr();
-            if (get_lcnf_size(env(), info->get_value()) > m_cfg.m_inline_threshold) return none_expr();
+            if (lcnf_size(info->get_value()) > m_cfg.m_inline_threshold) return none_expr();
             if (is_recursive(const_name(fn))) return none_expr();
             if (uses_unsafe_inductive(c)) return none_expr();
             return some_expr(beta_reduce(info->get_value(), e, is_let_val));
@@ -1970,8 +2039,10 @@ class csimp_fn {
     }
 
 public:
-    csimp_fn(elab_environment const & env, local_ctx const & lctx, bool before_erasure, csimp_cfg const & cfg):
-        m_env(env), m_st(env), m_lctx(lctx), m_before_erasure(before_erasure), m_cfg(cfg), m_x("_x"), m_j("j") {}
+    csimp_fn(elab_environment const & env, local_ctx const & lctx, bool before_erasure, csimp_cfg const & cfg,
+             csimp_stats & stats):
+        m_env(env), m_st(env), m_lctx(lctx), m_before_erasure(before_erasure), m_cfg(cfg), m_x("_x"), m_j("j"),
+        m_stats(stats) {}
 
     expr operator()(expr const & e) {
         if (is_lambda(e)) {
@@ -2105,11 +2176,17 @@ public:
 };
 
 expr csimp_core(elab_environment const & env, local_ctx const & lctx, expr const & e0, bool before_erasure, csimp_cfg const & cfg) {
-    csimp_fn simp(env, lctx, before_erasure, cfg);
+    csimp_stats stats;
+    csimp_fn simp(env, lctx, before_erasure, cfg, stats);
     elim_jp1_fn elim_jp1(env, lctx, before_erasure);
+    /* Subterms duplicated by inlining are shared again before each iteration. The memo tables of `simp` (and the
+       caches of its type checker) compare keys structurally; after sharing, equal keys are usually the same object,
+       so the comparison of a hit stops at the pointer equality test of `is_equal`. */
+    max_sharing_fn share;
     expr e = e0;
     while (true) {
-        e = simp(e);
+        stats.m_iterations++;
+        e = simp(share(e));
         bool modified = false;
         e = elim_jp1(e);
         if (elim_jp1.expanded())
@@ -2118,8 +2195,10 @@ expr csimp_core(elab_environment const & env, local_ctx const & lctx, expr const
         new_e = elim_dead_let(new_e);
         if (e != new_e)
             modified = true;
-        if (!modified)
+        if (!modified) {
+            lean_trace(name({"compiler", "simp_stats"}), tout() << stats;);
             return e;
+        }
         e = new_e;
     }
 }
@@ -10,25 +10,40 @@ Motivation
 ==========
 
 Even with a JIT compiler, we still have a need for a simpler interpreter on platforms LLVM JIT does not support (i.e.
-WebAssembly). Because this is mostly an edge case, we strive for simplicity instead of performance and thus reuse the
-existing compiler IR instead of inventing something like a new bytecode format.
+WebAssembly). It is also what runs `#eval`, macros, and tactics from the current module, so its performance matters.
+Walking the IR objects directly means decoding boxed `Nat`s and chasing constructor fields on every step, so we lower
+each declaration to a compact bytecode on first use instead and run that.
 
 Implementation
 ==============
 
 The interpreter mainly consists of a homogeneous stack of `value`s, which are either unboxed values or pointers to boxed
 objects. The IR type system tells us which union member is active at any time. IR variables are mapped to stack
-slots by adding the current base pointer to the variable index. Further stacks are used for storing join points and call
-stack metadata. The interpreted IR is taken directly from the elab_environment. Whenever possible, we try to switch to native
+slots by adding the current base pointer to the variable index. A further stack is used for storing call stack metadata.
+The interpreted IR is taken directly from the elab_environment and lowered to bytecode (see `opcode` and
+`bytecode_compiler`), where variables are slot indices, join points are jump targets, and `case` uses a jump table. The
+bytecode is executed by a threaded-dispatch loop where supported (`run`). Whenever possible, we try to switch to native
 code by checking for the mangled symbol via dlsym/GetProcAddress, which is also how we can call external functions
 (which only works if the file declaring them has already been compiled). We always call the "boxed" versions of native
 functions, which have a (relatively) homogeneous ABI that we can use without runtime code generation; see also
 `call/lookup_symbol` below.
 
 */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <mutex>
 #include <shared_mutex>
+#include <thread>
 #ifdef LEAN_WINDOWS
 #include <windows.h>
 #include <psapi.h>
@@ -42,17 +57,28 @@ functions, which have a (relatively) homogeneous ABI that we can use without run
 #include "runtime/io.h"
 #include "runtime/option_ref.h"
 #include "runtime/array_ref.h"
+#include "runtime/compact.h"
 #include "kernel/trace.h"
 #include "library/time_task.h"
 #include "library/compiler/ir.h"
 #include "library/compiler/init_attribute.h"
 #include "util/nat.h"
 #include "util/option_declarations.h"
+#include "util/io.h"
 
 #ifndef LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE
 #define LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE true
 #endif
 
+#ifndef LEAN_DEFAULT_INTERPRETER_PROFILER_INTERVAL
+#define LEAN_DEFAULT_INTERPRETER_PROFILER_INTERVAL 1000
+#endif
+
+// use computed gotos ("labels as values") for dispatching bytecode instructions where available
+#if defined(__GNUC__) && !defined(LEAN_INTERPRETER_SWITCH_DISPATCH)
+#define LEAN_INTERPRETER_THREADED_DISPATCH
+#endif
+
 namespace theorem_ai {
 namespace ir {
 // C++ wrappers of theorem_ai data types
@@ -194,6 +220,10 @@ static string_ref * g_mangle_prefix = nullptr;
 static string_ref * g_boxed_suffix = nullptr;
 static string_ref * g_boxed_mangled_suffix = nullptr;
 static name * g_interpreter_prefer_native = nullptr;
+static name * g_interpreter_tier_up_threshold = nullptr;
+static name * g_interpreter_profiler = nullptr;
+static name * g_interpreter_profiler_interval = nullptr;
+static name * g_interpreter_profiler_output = nullptr;
 
 // constants (lacking native declarations) initialized by `lean_run_init`
 static name_map<object *> * g_init_globals;
@@ -339,6 +369,24 @@ void * lookup_symbol_in_cur_exe(char const * sym) {
 #endif
 }
 
+/** \brief Load the shared library at `path` without adding its symbols to the global namespace. Returns `nullptr` on
+    failure. */
+static void * load_shared_lib(char const * path) {
+#ifdef LEAN_WINDOWS
+    return reinterpret_cast<void *>(LoadLibraryA(path));
+#else
+    return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+static void * lookup_symbol_in_lib(void * lib, char const * sym) {
+#ifdef LEAN_WINDOWS
+    return reinterpret_cast<void *>(GetProcAddress(static_cast<HMODULE>(lib), sym));
+#else
+    return dlsym(lib, sym);
+#endif
+}
+
 class interpreter;
 LEAN_THREAD_PTR(interpreter, g_interpreter);
 
@@ -347,6 +395,8 @@ struct native_symbol_cache_entry {
     void * m_addr;
     // true iff we chose the boxed version of a function where the IR uses the unboxed version
     bool m_boxed;
+    // address of the version with the signature of the IR declaration, if any
+    void * m_unboxed_addr;
 };
 
 // Caches native symbol lookup successes _and_ failures; we assume no native code is loaded or
@@ -355,29 +405,841 @@ name_map<native_symbol_cache_entry> * g_native_symbol_cache;
 // could be `shared_mutex` with C++17
 std::shared_timed_mutex * g_native_symbol_cache_mutex;
 
+/* Tiered execution.
+
+   Declarations of the current module never have native code in the running process, so long-running metaprograms
+   defined in the same project are always interpreted. If `interpreter.tier_up_threshold` is set, we count the calls of
+   such declarations and, once a declaration gets hot, compile it together with all the declarations of the current
+   module it (transitively) uses to C via `EmitC` and then to a shared library via `leanc`, in a dedicated task. The
+   interpreter continues in the meantime and switches to the native code once the library has been loaded.
+
+   The library is loaded without adding its symbols to the global namespace, so this does not invalidate
+   `g_native_symbol_cache`. Libraries are never unloaded as closures may point into them, but their files are deleted
+   once loaded (except on Windows, where loaded libraries cannot be deleted).
+
+   Entries are shared by `g_tier_up_entries`, the call sites resolved to them, and running jobs. They are removed from
+   `g_tier_up_entries` when their compilation fails, and when a new interpreter finds that the declaration has been
+   replaced in its environment, so that the table does not keep declarations of discarded environments alive. */
+struct tier_up_entry {
+    enum class state : uint8 { Interpreted, Compiling, Native, Failed };
+    // keeps the declaration, and thus the key of `g_tier_up_entries`, alive
+    decl                       m_decl;
+    std::atomic<unsigned>      m_calls;
+    std::atomic<state>         m_state;
+    // valid once `m_state` is `Native`
+    native_symbol_cache_entry  m_native;
+
+    explicit tier_up_entry(decl const & d): m_decl(d), m_calls(0), m_state(state::Interpreted), m_native{nullptr, false, nullptr} {}
+};
+
+/** \brief Compilation of a set of declarations in progress. */
+struct tier_up_job {
+    // `Task (Except IO.Error String)` resulting in the path of the shared library
+    object *                                    m_task;
+    std::vector<std::shared_ptr<tier_up_entry>> m_entries;
+};
+
+static std::mutex * g_tier_up_mutex;
+static std::unordered_map<object *, std::shared_ptr<tier_up_entry>> * g_tier_up_entries;
+static std::vector<tier_up_job> * g_tier_up_jobs;
+// number of declarations whose native code has been loaded, see `Lean.IR.getNumTieredUp`
+static std::atomic<unsigned> g_tier_up_num_native(0);
+// poll unfinished jobs only every so many calls of a declaration being compiled
+static constexpr unsigned tier_up_poll_interval = 256;
+
+extern "C" object * lean_ir_compile_decls_to_shared_lib(object * env, object * decls, object * w);
+
+/* Direct calls of native code with unboxed arguments.
+
+   Calling the boxed version of a native function means boxing each scalar argument, unboxing the scalar result, and
+   going through `curry`. For the common case of few arguments that are all passed in general-purpose registers
+   (objects and integers) or all in floating-point registers, we instead call the version with the IR signature through
+   one of the pre-generated stubs below. Integer arguments of any width are passed zero-extended as `uint64`, which is
+   compatible with the calling conventions of the 64-bit platforms we enable this on. WebAssembly checks the exact
+   signature of indirect calls, so there we always use the boxed versions. */
+#if !defined(LEAN_EMSCRIPTEN) && (defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(_M_ARM64))
+#define LEAN_INTERPRETER_UNBOXED_CALLS
+#endif
+
+static constexpr unsigned max_unboxed_args = 4;
+
+// how a native function passes its arguments
+enum class native_args : uint8 { Boxed, Words, Floats };
+// how a native function returns its result
+enum class native_ret : uint8 { Word, UInt8, UInt16, UInt32, Float, Float32 };
+
+template<typename R, typename A>
+static R call_native(void * f, unsigned n, A const * a) {
+    switch (n) {
+        case 1: return reinterpret_cast<R (*)(A)>(f)(a[0]);
+        case 2: return reinterpret_cast<R (*)(A, A)>(f)(a[0], a[1]);
+        case 3: return reinterpret_cast<R (*)(A, A, A)>(f)(a[0], a[1], a[2]);
+        case 4: return reinterpret_cast<R (*)(A, A, A, A)>(f)(a[0], a[1], a[2], a[3]);
+    }
+    lean_unreachable();
+}
+
+template<typename A>
+static value call_native_unboxed(void * f, native_ret ret, unsigned n, A const * a) {
+    switch (ret) {
+        case native_ret::Word:    return call_native<uint64>(f, n, a);
+        case native_ret::UInt8:   return static_cast<uint64>(call_native<uint8>(f, n, a));
+        case native_ret::UInt16:  return static_cast<uint64>(call_native<uint16>(f, n, a));
+        case native_ret::UInt32:  return static_cast<uint64>(call_native<uint32>(f, n, a));
+        case native_ret::Float:   return value::from_float(call_native<double>(f, n, a));
+        case native_ret::Float32: return value::from_float32(call_native<float>(f, n, a));
+    }
+    lean_unreachable();
+}
+
+static bool type_is_word(type t) {
+    switch (t) {
+        case type::UInt8:
+        case type::UInt16:
+        case type::UInt32:
+        case type::UInt64:
+        case type::USize:
+        case type::Irrelevant:
+        case type::Object:
+        case type::TObject:
+            return true;
+        case type::Float:
+        case type::Float32:
+        case type::Struct:
+        case type::Union:
+            return false;
+    }
+    lean_unreachable();
+}
+
+class code;
+
+/** \brief Resolved target of a call site: declaration, native code, and everything needed to call the latter. */
+struct call_target {
+    decl                      m_decl;
+    native_symbol_cache_entry m_native;
+    native_args               m_args = native_args::Boxed;
+    native_ret                m_ret  = native_ret::Word;
+    // parameter types and borrow annotations for calling the boxed version
+    std::vector<type>         m_param_types;
+    std::vector<bool>         m_param_borrow;
+    type                      m_type;
+    // bytecode if there is no native code
+    code const *              m_code = nullptr;
+    // tiered execution state if `m_code` is not persistent and tiered execution is enabled
+    std::shared_ptr<tier_up_entry> m_tier_up;
+
+    call_target(decl const & d, native_symbol_cache_entry const & native):
+        m_decl(d), m_native(native), m_type(decl_type(d)) {
+        array_ref<param> const & params = decl_params(d);
+        bool words = true, floats = true;
+        for (param const & p : params) {
+            type t = param_type(p);
+            m_param_types.push_back(t);
+            m_param_borrow.push_back(param_borrow(p));
+            words  = words && type_is_word(t);
+            floats = floats && t == type::Float;
+        }
+#ifdef LEAN_INTERPRETER_UNBOXED_CALLS
+        if (m_native.m_unboxed_addr && params.size() > 0 && params.size() <= max_unboxed_args &&
+            m_type != type::Struct && m_type != type::Union) {
+            m_args = words ? native_args::Words : floats ? native_args::Floats : native_args::Boxed;
+            switch (m_type) {
+                case type::UInt8:   m_ret = native_ret::UInt8; break;
+                case type::UInt16:  m_ret = native_ret::UInt16; break;
+                case type::UInt32:  m_ret = native_ret::UInt32; break;
+                case type::Float:   m_ret = native_ret::Float; break;
+                case type::Float32: m_ret = native_ret::Float32; break;
+                default:            m_ret = native_ret::Word; break;
+            }
+        }
+#else
+        (void)words; (void)floats;
+#endif
+    }
+};
+
+/** \brief Inline cache of a `FAp` or `PAp` instruction. */
+struct call_site {
+    // The resolution depends on `interpreter.prefer_native`, so we cache it for both values. Each entry is set at most
+    // once, so that instructions of shared bytecode can be executed concurrently.
+    std::atomic<call_target *> m_target[2];
+
+    call_site() {
+        m_target[0] = nullptr;
+        m_target[1] = nullptr;
+    }
+    ~call_site() {
+        delete m_target[0].load();
+        delete m_target[1].load();
+    }
+};
+
+/** \brief Opcodes of the bytecode executed by the interpreter.
+
+    Each declaration's `fn_body` is lowered once into a flat array of `instr`s (see `bytecode_compiler` below): IR
+    variables are resolved to frame slots, constructor infos and literals are decoded, join points become jump targets,
+    and `Case` becomes a jump table indexed by constructor tag. Calls of top-level functions have an inline cache for
+    their resolved target (`call_site`). Expressions that are comparatively rare or expensive anyway (`Reset`, `Reuse`,
+    `Ap`) keep pointing at their IR node and are evaluated by `eval_expr`. */
+enum class opcode : uint8 {
+    Expr,        // x := e          m_ir: e
+    Scalar,      // x := c          m_val: pre-decoded unboxed literal or nullary constructor
+    LitObj,      // x := o          m_ir: boxed literal
+    FAp,         // x := f ys       m_ir: `FAp` expression, m_d: call site
+    PAp,         // x := pap f ys   m_ir: `PAp` expression, m_d: call site
+    Ctor,        // x := ctor ys    m_a/m_b: argument slots, m_c: tag, m_d: #object fields, m_val: scalar byte size
+    Proj,        // x := proj[i] y  m_a: y, m_b: i
+    UProj,       // x := uproj[i] y m_a: y, m_b: i
+    SProj,       // x := sproj y    m_a: y, m_b: byte offset
+    Box,         // x := box y      m_a: y, m_c: type of y
+    Unbox,       // x := unbox y    m_a: y
+    IsShared,    // x := isShared y m_a: y
+    IsTaggedPtr, // x := isTaggedPtr y  m_a: y
+    Set,         // set y[i] := z   m_a: y, m_b: i, m_c: z
+    SetTag,      // setTag y := i   m_a: y, m_b: i
+    USet,        // uset y[i] := z  m_a: y, m_b: i, m_c: z
+    SSet,        // sset y := z     m_a: y, m_b: byte offset, m_c: z
+    Inc,         // inc y n         m_a: y, m_b: n
+    Dec,         // dec y n         m_a: y, m_b: n
+    Del,         // del y           m_a: y
+    Case,        // case y of ...   m_a: y, m_b/m_c: jump table, m_d: default target
+    Jmp,         // jmp j ys        m_a/m_b: argument slots, m_c: target, m_d: parameter slots of `j`
+    TailCall,    // ret (f ys)      m_a/m_b: argument slots, where `f` is the current function
+    Ret,         // ret y           m_a: y
+    Unreachable,
+};
+static constexpr unsigned num_opcodes = static_cast<unsigned>(opcode::Unreachable) + 1;
+
+// slot of an irrelevant argument, and target of a missing `Case` alternative
+static constexpr unsigned no_slot   = std::numeric_limits<unsigned>::max();
+static constexpr unsigned no_target = std::numeric_limits<unsigned>::max();
+
+struct instr {
+    opcode   m_op   = opcode::Unreachable;
+    // type of `x` in `x := e` instructions, or of `y` in `SSet` and `Case`
+    type     m_type = type::Irrelevant;
+    // slot of `x` in `x := e` instructions
+    unsigned m_dst  = 0;
+    // operands as documented at `opcode`; argument lists are ranges in `code::m_slots`
+    unsigned m_a    = 0;
+    unsigned m_b    = 0;
+    unsigned m_c    = 0;
+    unsigned m_d    = 0;
+    value    m_val  { static_cast<uint64>(0) };
+    // IR node of instructions that defer to the tree-walking `eval_expr`; kept alive by `code::m_decl`
+    object * m_ir   = nullptr;
+    // `fn_body` this instruction was lowered from, for tracing
+    object * m_body = nullptr;
+};
+
+/** \brief Bytecode of a single declaration. */
+class code {
+public:
+    decl                  m_decl;
+    std::vector<instr>    m_instrs;
+    // argument slots of constructors, jumps, and tail calls, and parameter slots of join points
+    std::vector<unsigned> m_slots;
+    // jump tables of `Case` instructions
+    std::vector<unsigned> m_targets;
+    // number of variable slots of a frame; known in advance, so the frame only has to be allocated once per call
+    unsigned              m_num_slots = 0;
+    // inline caches of `FAp` and `PAp` instructions
+    unsigned              m_num_call_sites = 0;
+    std::unique_ptr<call_site[]> m_call_sites;
+
+    explicit code(decl const & d): m_decl(d) {}
+};
+
+/** \brief Lowering of a `fn_body` to `code`. */
+class bytecode_compiler {
+    code & m_code;
+    struct jp_entry {
+        size_t                m_id;
+        unsigned              m_params;
+        unsigned              m_num_params;
+        // `Jmp` instructions whose target is not known yet
+        std::vector<unsigned> m_fixups;
+    };
+    // join points in scope, innermost last
+    std::vector<jp_entry> m_jps;
+
+    unsigned slot(var_id const & x) {
+        // variables are 1-indexed
+        unsigned i = x.get_small_value() - 1;
+        m_code.m_num_slots = std::max(m_code.m_num_slots, i + 1);
+        return i;
+    }
+
+    unsigned arg_slot(arg const & a) {
+        return arg_is_irrelevant(a) ? no_slot : slot(arg_var_id(a));
+    }
+
+    unsigned add_args(array_ref<arg> const & args) {
+        unsigned offset = m_code.m_slots.size();
+        for (arg const & a : args) {
+            m_code.m_slots.push_back(arg_slot(a));
+        }
+        return offset;
+    }
+
+    /** \brief Append an instruction. The reference is only valid until the next call. */
+    instr & emit(opcode op, fn_body const & b) {
+        m_code.m_instrs.emplace_back();
+        instr & i = m_code.m_instrs.back();
+        i.m_op   = op;
+        i.m_body = b.raw();
+        return i;
+    }
+
+    jp_entry & find_jp(jp_id const & j) {
+        size_t id = j.get_small_value();
+        for (size_t i = m_jps.size(); i > 0; i--) {
+            if (m_jps[i - 1].m_id == id) {
+                return m_jps[i - 1];
+            }
+        }
+        throw exception(sstream() << "(interpreter) unknown join point " << id << " in '" << decl_fun_id(m_code.m_decl) << "'");
+    }
+
+    bool is_self_tail_call(fn_body const & b) {
+        expr const & e = fn_body_vdecl_expr(b);
+        fn_body const & cont = fn_body_vdecl_cont(b);
+        return expr_tag(e) == expr_kind::FAp && expr_fap_fun(e) == decl_fun_id(m_code.m_decl) &&
+            fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
+            arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b);
+    }
+
+    void compile_lit(fn_body const & b, unsigned x, type t, lit_val const & l) {
+        if (lit_val_tag(l) == lit_val_kind::Str) {
+            emit(opcode::LitObj, b).m_ir = lit_val_str(l).raw();
+            return;
+        }
+        nat const & n = lit_val_num(l);
+        value v;
+        switch (t) {
+            case type::Float:
+                lean_inc(n.raw());
+                v = value::from_float(lean_float_of_nat(n.raw()));
+                break;
+            case type::Float32:
+                lean_inc(n.raw());
+                v = value::from_float32(lean_float32_of_nat(n.raw()));
+                break;
+            case type::UInt8:
+            case type::UInt16:
+            case type::UInt32:
+            case type::USize:
+                v = lean_usize_of_nat(n.raw());
+                break;
+            case type::UInt64:
+                v = lean_uint64_of_nat(n.raw());
+                break;
+            case type::Object:
+            case type::TObject: {
+                instr & i = emit(opcode::LitObj, b);
+                i.m_dst = x;
+                i.m_ir  = n.raw();
+                return;
+            }
+            case type::Irrelevant:
+            case type::Union:
+            case type::Struct:
+                throw exception("invalid instruction");
+        }
+        instr & i = emit(opcode::Scalar, b);
+        i.m_dst = x;
+        i.m_val = v;
+    }
+
+    void compile_vdecl(fn_body const & b) {
+        expr const & e = fn_body_vdecl_expr(b);
+        type t = fn_body_vdecl_type(b);
+        unsigned x = slot(fn_body_vdecl_var(b));
+        switch (expr_tag(e)) {
+            case expr_kind::Ctor: {
+                ctor_info const & c = expr_ctor_info(e);
+                unsigned tag = ctor_info_tag(c).get_small_value();
+                // number of boxed object fields
+                unsigned size = ctor_info_size(c).get_small_value();
+                // number of unboxed USize fields (whose byte size the IR is ignorant of)
+                unsigned usize = ctor_info_usize(c).get_small_value();
+                // byte size of all other unboxed fields
+                unsigned ssize = ctor_info_ssize(c).get_small_value();
+                if (size == 0 && usize == 0 && ssize == 0) {
+                    // a constructor without data is optimized to a tagged pointer
+                    instr & i = emit(opcode::Scalar, b);
+                    i.m_dst = x;
+                    i.m_val = box(tag);
+                } else {
+                    unsigned args = add_args(expr_ctor_args(e));
+                    instr & i = emit(opcode::Ctor, b);
+                    i.m_dst = x;
+                    i.m_a   = args;
+                    i.m_b   = expr_ctor_args(e).size();
+                    i.m_c   = tag;
+                    i.m_d   = size;
+                    i.m_val = static_cast<uint64>(usize * sizeof(void *) + ssize);
+                }
+                return;
+            }
+            case expr_kind::Proj: {
+                unsigned y = slot(expr_proj_obj(e));
+                instr & i = emit(opcode::Proj, b);
+                i.m_dst = x;
+                i.m_a   = y;
+                i.m_b   = expr_proj_idx(e).get_small_value();
+                return;
+            }
+            case expr_kind::UProj: {
+                unsigned y = slot(expr_uproj_obj(e));
+                instr & i = emit(opcode::UProj, b);
+                i.m_dst = x;
+                i.m_a   = y;
+                i.m_b   = expr_uproj_idx(e).get_small_value();
+                return;
+            }
+            case expr_kind::SProj: {
+                unsigned y = slot(expr_sproj_obj(e));
+                instr & i = emit(opcode::SProj, b);
+                i.m_dst  = x;
+                i.m_type = t;
+                i.m_a    = y;
+                i.m_b    = expr_sproj_idx(e).get_small_value() * sizeof(void *) + expr_sproj_offset(e).get_small_value();
+                return;
+            }
+            case expr_kind::FAp:
+            case expr_kind::PAp: {
+                instr & i = emit(expr_tag(e) == expr_kind::FAp ? opcode::FAp : opcode::PAp, b);
+                i.m_dst  = x;
+                i.m_type = t;
+                i.m_d    = m_code.m_num_call_sites++;
+                i.m_ir   = e.raw();
+                return;
+            }
+            case expr_kind::Box: {
+                unsigned y = slot(expr_box_obj(e));
+                instr & i = emit(opcode::Box, b);
+                i.m_dst = x;
+                i.m_a   = y;
+                i.m_c   = static_cast<unsigned>(expr_box_type(e));
+                return;
+            }
+            case expr_kind::Unbox: {
+                unsigned y = slot(expr_unbox_obj(e));
+                instr & i = emit(opcode::Unbox, b);
+                i.m_dst  = x;
+                i.m_type = t;
+                i.m_a    = y;
+                return;
+            }
+            case expr_kind::Lit:
+                compile_lit(b, x, t, expr_lit_val(e));
+                return;
+            case expr_kind::IsShared: {
+                unsigned y = slot(expr_is_shared_obj(e));
+                instr & i = emit(opcode::IsShared, b);
+                i.m_dst = x;
+                i.m_a   = y;
+                return;
+            }
+            case expr_kind::IsTaggedPtr: {
+                unsigned y = slot(expr_is_tagged_ptr_obj(e));
+                instr & i = emit(opcode::IsTaggedPtr, b);
+                i.m_dst = x;
+                i.m_a   = y;
+                return;
+            }
+            case expr_kind::Reset:
+            case expr_kind::Reuse:
+            case expr_kind::Ap: {
+                instr & i = emit(opcode::Expr, b);
+                i.m_dst  = x;
+                i.m_type = t;
+                i.m_ir   = e.raw();
+                return;
+            }
+        }
+        throw exception(sstream() << "unexpected instruction kind " << static_cast<unsigned>(expr_tag(e)));
+    }
+
+    void compile_case(fn_body const & b) {
+        unsigned y = slot(fn_body_case_var(b));
+        unsigned idx = m_code.m_instrs.size();
+        emit(opcode::Case, b);
+        array_ref<alt_core> const & alts = fn_body_case_alts(b);
+        unsigned size = 0;
+        for (alt_core const & a : alts) {
+            if (alt_core_tag(a) == alt_core_kind::Ctor) {
+                size = std::max(size, static_cast<unsigned>(ctor_info_tag(alt_core_ctor_info(a)).get_small_value()) + 1);
+            }
+        }
+        unsigned table = m_code.m_targets.size();
+        m_code.m_targets.resize(table + size, no_target);
+        unsigned dflt = no_target;
+        // alternatives are tried in order, so only the first one for each tag and the first default are reachable
+        for (alt_core const & a : alts) {
+            if (alt_core_tag(a) == alt_core_kind::Ctor) {
+                unsigned tag = ctor_info_tag(alt_core_ctor_info(a)).get_small_value();
+                if (m_code.m_targets[table + tag] == no_target) {
+                    m_code.m_targets[table + tag] = m_code.m_instrs.size();
+                    compile(alt_core_ctor_cont(a));
+                }
+            } else {
+                dflt = m_code.m_instrs.size();
+                compile(alt_core_default_cont(a));
+                break;
+            }
+        }
+        for (unsigned i = table; i < table + size; i++) {
+            if (m_code.m_targets[i] == no_target) {
+                m_code.m_targets[i] = dflt;
+            }
+        }
+        instr & i = m_code.m_instrs[idx];
+        i.m_type = fn_body_case_var_type(b);
+        i.m_a    = y;
+        i.m_b    = table;
+        i.m_c    = size;
+        i.m_d    = dflt;
+    }
+
+    void compile(fn_body const & b0) {
+        // make reference reassignable...
+        std::reference_wrapper<fn_body const> b(b0);
+        while (true) {
+            switch (fn_body_tag(b)) {
+                case fn_body_kind::VDecl:
+                    if (is_self_tail_call(b)) {
+                        // copy argument values to parameter slots and jump back to the start
+                        array_ref<arg> const & args = expr_fap_args(fn_body_vdecl_expr(b));
+                        unsigned offset = add_args(args);
+                        instr & i = emit(opcode::TailCall, b);
+                        i.m_a = offset;
+                        i.m_b = args.size();
+                        return;
+                    }
+                    compile_vdecl(b);
+                    b = fn_body_vdecl_cont(b);
+                    break;
+                case fn_body_kind::JDecl: {
+                    // Compile the continuation first so that the body of the join point can be placed right after it
+                    // and the jumps to it be patched afterwards. Join points are not recursive, so the body is
+                    // compiled with the join point out of scope.
+                    jp_entry jp;
+                    jp.m_id = fn_body_jdecl_id(b).get_small_value();
+                    jp.m_params = m_code.m_slots.size();
+                    jp.m_num_params = fn_body_jdecl_params(b).size();
+                    for (param const & p : fn_body_jdecl_params(b)) {
+                        m_code.m_slots.push_back(slot(param_var(p)));
+                    }
+                    m_jps.push_back(std::move(jp));
+                    compile(fn_body_jdecl_cont(b));
+                    std::vector<unsigned> fixups = std::move(m_jps.back().m_fixups);
+                    m_jps.pop_back();
+                    if (fixups.empty()) {
+                        return;
+                    }
+                    unsigned target = m_code.m_instrs.size();
+                    for (unsigned i : fixups) {
+                        m_code.m_instrs[i].m_c = target;
+                    }
+                    b = fn_body_jdecl_body(b);
+                    break;
+                }
+                case fn_body_kind::Set: {
+                    unsigned y = slot(fn_body_set_var(b));
+                    unsigned z = arg_slot(fn_body_set_arg(b));
+                    instr & i = emit(opcode::Set, b);
+                    i.m_a = y;
+                    i.m_b = fn_body_set_idx(b).get_small_value();
+                    i.m_c = z;
+                    b = fn_body_set_cont(b);
+                    break;
+                }
+                case fn_body_kind::SetTag: {
+                    unsigned y = slot(fn_body_set_tag_var(b));
+                    instr & i = emit(opcode::SetTag, b);
+                    i.m_a = y;
+                    i.m_b = fn_body_set_tag_cidx(b).get_small_value();
+                    b = fn_body_set_tag_cont(b);
+                    break;
+                }
+                case fn_body_kind::USet: {
+                    unsigned y = slot(fn_body_uset_target(b));
+                    unsigned z = slot(fn_body_uset_source(b));
+                    instr & i = emit(opcode::USet, b);
+                    i.m_a = y;
+                    i.m_b = fn_body_uset_idx(b).get_small_value();
+                    i.m_c = z;
+                    b = fn_body_uset_cont(b);
+                    break;
+                }
+                case fn_body_kind::SSet: {
+                    unsigned y = slot(fn_body_sset_target(b));
+                    unsigned z = slot(fn_body_sset_source(b));
+                    instr & i = emit(opcode::SSet, b);
+                    i.m_type = fn_body_sset_type(b);
+                    i.m_a    = y;
+                    i.m_b    = fn_body_sset_idx(b).get_small_value() * sizeof(void *) + fn_body_sset_offset(b).get_small_value();
+                    i.m_c    = z;
+                    b = fn_body_sset_cont(b);
+                    break;
+                }
+                case fn_body_kind::Inc: {
+                    unsigned y = slot(fn_body_inc_var(b));
+                    instr & i = emit(opcode::Inc, b);
+                    i.m_a = y;
+                    i.m_b = fn_body_inc_val(b).get_small_value();
+                    b = fn_body_inc_cont(b);
+                    break;
+                }
+                case fn_body_kind::Dec: {
+                    unsigned y = slot(fn_body_dec_var(b));
+                    instr & i = emit(opcode::Dec, b);
+                    i.m_a = y;
+                    i.m_b = fn_body_dec_val(b).get_small_value();
+                    b = fn_body_dec_cont(b);
+                    break;
+                }
+                case fn_body_kind::Del: {
+                    unsigned y = slot(fn_body_del_var(b));
+                    emit(opcode::Del, b).m_a = y;
+                    b = fn_body_del_cont(b);
+                    break;
+                }
+                case fn_body_kind::MData: // metadata; no-op
+                    b = fn_body_mdata_cont(b);
+                    break;
+                case fn_body_kind::Case:
+                    compile_case(b);
+                    return;
+                case fn_body_kind::Ret: {
+                    unsigned y = arg_slot(fn_body_ret_arg(b));
+                    emit(opcode::Ret, b).m_a = y;
+                    return;
+                }
+                case fn_body_kind::Jmp: {
+                    array_ref<arg> const & args = fn_body_jmp_args(b);
+                    unsigned offset = add_args(args);
+                    jp_entry & jp = find_jp(fn_body_jmp_jp(b));
+                    lean_assert(jp.m_num_params == args.size());
+                    jp.m_fixups.push_back(m_code.m_instrs.size());
+                    instr & i = emit(opcode::Jmp, b);
+                    i.m_a = offset;
+                    i.m_b = args.size();
+                    i.m_c = no_target;
+                    i.m_d = jp.m_params;
+                    return;
+                }
+                case fn_body_kind::Unreachable:
+                    emit(opcode::Unreachable, b);
+                    return;
+            }
+        }
+    }
+public:
+    explicit bytecode_compiler(code & c): m_code(c) {}
+
+    void operator()() {
+        for (param const & p : decl_params(m_code.m_decl)) {
+            slot(param_var(p));
+        }
+        compile(decl_fun_body(m_code.m_decl));
+        m_code.m_call_sites.reset(new call_site[m_code.m_num_call_sites]);
+    }
+};
+
+struct constant_cache_entry {
+    bool m_is_scalar;
+    value m_val;
+};
+
+/* Process-wide caches for persistent declarations.
+
+   Persistent IR declarations (in particular all those of imported modules, which live in compacted regions or have been
+   marked persistent together with the imported environment) are never modified, and are only freed together with their
+   compacted region by `Environment.freeRegions`. Until then, their address identifies them. Their bytecode and the
+   values of persistent closed constants can thus be shared by all interpreter instances and threads instead of being
+   recomputed whenever `with_interpreter` creates a new interpreter for a new environment. The entries of a region are
+   dropped before it is freed by `drop_region_entries`, since a region loaded later may be mapped at the same address.
+   Declarations of the current module are not persistent and use the per-interpreter caches, which are discarded
+   together with the environment they were computed in. */
+static std::shared_timed_mutex * g_persistent_cache_mutex;
+static std::unordered_map<object *, std::unique_ptr<code>> * g_persistent_code_cache;
+static std::unordered_map<object *, constant_cache_entry> * g_persistent_constant_cache;
+
+template<typename T> static void erase_region_entries(std::unordered_map<object *, T> & m, void const * begin, void const * end) {
+    uintptr_t b = reinterpret_cast<uintptr_t>(begin);
+    uintptr_t e = reinterpret_cast<uintptr_t>(end);
+    for (auto it = m.begin(); it != m.end();) {
+        uintptr_t k = reinterpret_cast<uintptr_t>(it->first);
+        if (b <= k && k < e)
+            it = m.erase(it);
+        else
+            ++it;
+    }
+}
+
+/* Called before the compacted region `[begin, end)` is freed. No code of the region may be running by then. The values
+   of dropped constants are persistent and thus not freed, like all such values. */
+static void drop_region_entries(void const * begin, void const * end) {
+    std::unique_lock<std::shared_timed_mutex> lock(*g_persistent_cache_mutex);
+    erase_region_entries(*g_persistent_code_cache, begin, end);
+    erase_region_entries(*g_persistent_constant_cache, begin, end);
+}
+
+/* Sampling profiler.
+
+   If `interpreter.profiler` is set, a background thread increments `g_profiler_tick` every
+   `interpreter.profiler.interval` microseconds. Before each instruction, and after each instruction that may call other
+   code, the interpreter checks whether the counter has changed and, if so, records its current call stack with the
+   instruction as the innermost frame, weighted by the number of ticks since the last check. Time spent in native code
+   called by an instruction is thus charged to that instruction rather than to the next one. When the last
+   profiling interpreter is destroyed, the samples are appended in the "folded stacks" format of `flamegraph.pl` and
+   speedscope to `interpreter.profiler.output`, or summarized by declaration and instruction on the trace output if no
+   file is given. */
+static std::atomic<unsigned> g_profiler_tick(0);
+
+class interpreter_profiler {
+    // serializes starting and stopping sessions
+    std::mutex                      m_session_mutex;
+    unsigned                        m_num_users = 0;
+    unsigned                        m_interval = 0;
+    std::string                     m_output;
+    std::thread                     m_ticker;
+    // protects the fields below
+    std::mutex                      m_mutex;
+    std::condition_variable         m_stop_cv;
+    bool                            m_stop = false;
+    // number of samples by folded stack
+    std::map<std::string, unsigned> m_samples;
+
+    /** \brief Split a folded stack into its frames. */
+    static std::vector<std::string> frames(std::string const & stack) {
+        std::vector<std::string> r;
+        size_t begin = 0;
+        while (true) {
+            size_t end = stack.find(';', begin);
+            r.push_back(stack.substr(begin, end - begin));
+            if (end == std::string::npos) {
+                return r;
+            }
+            begin = end + 1;
+        }
+    }
+
+    template<typename M>
+    static void report_top(M const & counts, char const * header, unsigned total) {
+        std::vector<std::pair<unsigned, std::string>> sorted;
+        for (auto const & p : counts) {
+            sorted.emplace_back(p.second, p.first);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](std::pair<unsigned, std::string> const & a, std::pair<unsigned, std::string> const & b) {
+            return a.first > b.first;
+        });
+        tout() << header << "\n";
+        for (size_t i = 0; i < sorted.size() && i < 20; i++) {
+            tout() << "  " << sorted[i].first << " (" << (100.0 * sorted[i].first / total) << "%) " << sorted[i].second << "\n";
+        }
+    }
+
+    void report() {
+        if (m_samples.empty()) {
+            return;
+        }
+        if (!m_output.empty()) {
+            std::ofstream out(m_output, std::ios::app);
+            for (auto const & s : m_samples) {
+                out << s.first << " " << s.second << "\n";
+            }
+            return;
+        }
+        unsigned total = 0;
+        std::map<std::string, unsigned> self, incl, instrs;
+        for (auto const & s : m_samples) {
+            std::vector<std::string> fs = frames(s.first);
+            total += s.second;
+            // innermost frame is the instruction, the one before its declaration
+            instrs[fs[fs.size() - 2] + " " + fs.back()] += s.second;
+            self[fs[fs.size() - 2]] += s.second;
+            std::sort(fs.begin(), fs.end() - 1);
+            for (auto it = fs.begin(); it != fs.end() - 1; it++) {
+                if (it == fs.begin() || *it != *(it - 1)) {
+                    incl[*it] += s.second;
+                }
+            }
+        }
+        tout() << "interpreter profile: " << total << " samples, one every " << m_interval << "us\n";
+        report_top(self, "self samples by declaration:", total);
+        report_top(incl, "total samples by declaration:", total);
+        report_top(instrs, "samples by instruction:", total);
+    }
+
+public:
+    void start(unsigned interval, std::string const & output) {
+        std::lock_guard<std::mutex> session_lock(m_session_mutex);
+        if (m_num_users++ > 0) {
+            // join the running session
+            return;
+        }
+        m_interval = std::max(interval, 1u);
+        m_output   = output;
+        m_stop     = false;
+        m_ticker   = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_stop_cv.wait_for(lock, std::chrono::microseconds(m_interval), [this]() { return m_stop; })) {
+                g_profiler_tick.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> session_lock(m_session_mutex);
+        if (--m_num_users > 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_stop_cv.notify_all();
+        m_ticker.join();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        report();
+        m_samples.clear();
+    }
+
+    void add_sample(std::string const & stack, unsigned weight) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_samples[stack] += weight;
+    }
+};
+
+static interpreter_profiler * g_profiler;
+
 class interpreter {
     // stack of IR variable slots
     std::vector<value> m_arg_stack;
-    // stack of join points
-    std::vector<fn_body const *> m_jp_stack;
     struct frame {
         name m_fn;
-        // base pointers into the stack above
+        // base pointer into the stack above
         size_t m_arg_bp;
-        size_t m_jp_bp;
 
-        frame(name const & mFn, size_t mArgBp, size_t mJpBp) : m_fn(mFn), m_arg_bp(mArgBp), m_jp_bp(mJpBp) {}
+        frame(name const & mFn, size_t mArgBp) : m_fn(mFn), m_arg_bp(mArgBp) {}
     };
     std::vector<frame> m_call_stack;
     elab_environment const & m_env;
     options const & m_opts;
     // if `false`, use IR code where possible
     bool m_prefer_native;
-    struct constant_cache_entry {
-      bool m_is_scalar;
-      value m_val;
-    };
-    // caches values of nullary functions ("constants")
+    // number of calls after which a declaration of the current module is compiled to native code; 0 if disabled
+    unsigned m_tier_up_threshold;
+    // whether we take part in the session of `g_profiler`
+    bool m_profile;
+    // value of `g_profiler_tick` at the last sample
+    unsigned m_profiler_tick;
+    // caches values of nullary functions ("constants") not in `g_persistent_constant_cache`
     name_map<constant_cache_entry> m_constant_cache;
     struct symbol_cache_entry {
         // looking up IR from .oleans is slow enough to warrant its own cache; but as local IR can
@@ -387,6 +1249,8 @@ class interpreter {
     };
     // caches symbol lookup successes _and_ failures
     name_map<symbol_cache_entry> m_symbol_cache;
+    // bytecode of interpreted non-persistent declarations, keyed by the declaration object
+    std::unordered_map<object *, std::unique_ptr<code>> m_code_cache;
 
     /** \brief Get current stack frame */
     inline frame & get_frame() {
@@ -460,6 +1324,24 @@ private:
         return cls;
     }
 
+    object * mk_pap(decl const & d, native_symbol_cache_entry const & native, array_ref<arg> const & args) {
+        if (native.m_addr) {
+            // point closure directly at native symbol
+            object * cls = alloc_closure(native.m_addr, decl_params(d).size(), args.size());
+            for (unsigned i = 0; i < args.size(); i++) {
+                closure_set(cls, i, eval_arg(args[i]).m_obj);
+            }
+            return cls;
+        } else {
+            // point closure at interpreter stub
+            object ** args2 = static_cast<object **>(LEAN_ALLOCA(args.size() * sizeof(object *))); // NOLINT
+            for (size_t i = 0; i < args.size(); i++) {
+                args2[i] = eval_arg(args[i]).m_obj;
+            }
+            return mk_stub_closure(d, args.size(), args2);
+        }
+    }
+
     value eval_expr(expr const & e, type t) {
         switch (expr_tag(e)) {
             case expr_kind::Ctor:
@@ -528,21 +1410,7 @@ private:
             }
             case expr_kind::PAp: { // unsatured (partial) application of top-level function
                 symbol_cache_entry sym = lookup_symbol(expr_pap_fun(e));
-                if (sym.m_native.m_addr) {
-                    // point closure directly at native symbol
-                    object * cls = alloc_closure(sym.m_native.m_addr, decl_params(sym.m_decl).size(), expr_pap_args(e).size());
-                    for (unsigned i = 0; i < expr_pap_args(e).size(); i++) {
-                        closure_set(cls, i, eval_arg(expr_pap_args(e)[i]).m_obj);
-                    }
-                    return cls;
-                } else {
-                    // point closure at interpreter stub
-                    object ** args = static_cast<object **>(LEAN_ALLOCA(expr_pap_args(e).size() * sizeof(object *))); // NOLINT
-                    for (size_t i = 0; i < expr_pap_args(e).size(); i++) {
-                        args[i] = eval_arg(expr_pap_args(e)[i]).m_obj;
-                    }
-                    return mk_stub_closure(sym.m_decl, expr_pap_args(e).size(), args);
-                }
+                return mk_pap(sym.m_decl, sym.m_native, expr_pap_args(e));
             }
             case expr_kind::Ap: { // (saturated or unsatured) application of closure; mostly handled by runtime
                 object ** args = static_cast<object **>(LEAN_ALLOCA(expr_ap_args(e).size() * sizeof(object *))); // NOLINT
@@ -612,87 +1480,253 @@ private:
         }
     }
 
-    value eval_body(fn_body const & b0) {
+#ifdef LEAN_DEBUG
+    void trace_step(instr const * pc) {
+        lean_trace(name({"interpreter", "step"}),
+                   tout() << std::string(m_call_stack.size(), ' ') << format_fn_body_head(TO_REF(fn_body, pc->m_body)) << "\n";);
+    }
+#endif
+
+    /** \brief Return the bytecode of the given persistent declaration, compiling it on first use. */
+    static code const & get_persistent_code(decl const & d) {
+        lean_assert(lean_is_persistent(d.raw()));
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(*g_persistent_cache_mutex);
+            auto it = g_persistent_code_cache->find(d.raw());
+            if (it != g_persistent_code_cache->end()) {
+                return *it->second;
+            }
+        }
+        std::unique_ptr<code> c(new code(d));
+        bytecode_compiler compiler(*c);
+        compiler();
+        std::unique_lock<std::shared_timed_mutex> lock(*g_persistent_cache_mutex);
+        // keeps the existing entry if another thread was faster
+        return *g_persistent_code_cache->emplace(d.raw(), std::move(c)).first->second;
+    }
+
+    /** \brief Return the bytecode of the given declaration, compiling it on first use. */
+    code const & get_code(decl const & d) {
+        if (lean_is_persistent(d.raw())) {
+            return get_persistent_code(d);
+        }
+        auto it = m_code_cache.find(d.raw());
+        if (it != m_code_cache.end()) {
+            return *it->second;
+        }
+        std::unique_ptr<code> c(new code(d));
+        bytecode_compiler compiler(*c);
+        compiler();
+        code const & r = *c;
+        // `c` keeps `d` alive, so its address stays a valid key
+        m_code_cache.emplace(d.raw(), std::move(c));
+        return r;
+    }
+
+    /** \brief Get reference to stack slot of bytecode variable in frame with base pointer `bp` */
+    inline value & slot(size_t bp, unsigned i) {
+        return m_arg_stack[bp + i];
+    }
+
+    inline value slot_arg(size_t bp, unsigned i) {
+        // an "irrelevant" argument is type- or proof-erased; we can use an arbitrary value for it
+        return i == no_slot ? value(box(0)) : m_arg_stack[bp + i];
+    }
+
+    inline void set_slot(size_t bp, instr const & i, value v) {
+        slot(bp, i.m_dst) = v;
+        DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
+                              tout() << std::string(m_call_stack.size(), ' ') << "=> x_" << (i.m_dst + 1) << " = ";
+                              print_value(tout(), v, i.m_type);
+                              tout() << "\n";);)
+    }
+
+    /** \brief Record a profiler sample of the current call stack, executing instruction `pc` of `c`, for the ticks
+        elapsed since the last sample. */
+    void sample(code const & c, instr const * pc) {
+        unsigned tick = g_profiler_tick.load(std::memory_order_relaxed);
+        unsigned weight = tick - m_profiler_tick;
+        m_profiler_tick = tick;
+        if (!m_profile) {
+            return;
+        }
+        std::string stack;
+        for (frame const & f : m_call_stack) {
+            stack += f.m_fn.to_string();
+            stack += ';';
+        }
+        std::string i = format_fn_body_head(TO_REF(fn_body, pc->m_body));
+        // `;` separates frames in the folded format
+        std::replace(i.begin(), i.end(), ';', ',');
+        std::replace(i.begin(), i.end(), '\n', ' ');
+        stack += "[" + std::to_string(pc - c.m_instrs.data()) + "] " + i;
+        g_profiler->add_sample(stack, weight);
+    }
+
+    /** \brief Execute the bytecode of the function of the current frame. */
+    value run(code const & c) {
         check_system();
 
-        // make reference reassignable...
-        std::reference_wrapper<fn_body const> b(b0);
+        size_t bp = get_frame().m_arg_bp;
+        if (m_arg_stack.size() < bp + c.m_num_slots) {
+            m_arg_stack.resize(bp + c.m_num_slots);
+        }
+        // NOTE: calls may resize `m_arg_stack`, so we must not hold references to slots across instructions
+        instr const * const base = c.m_instrs.data();
+        unsigned const * const slots = c.m_slots.data();
+        unsigned const * const targets = c.m_targets.data();
+        instr const * pc = base;
+
+        // a single load and compare per instruction when not profiling; also used after instructions that may call
+        // other code, before advancing `pc`, so that the time spent in native callees is charged to the call
+#define INTERP_SAMPLE() if (LEAN_UNLIKELY(g_profiler_tick.load(std::memory_order_relaxed) != m_profiler_tick)) sample(c, pc)
+#ifdef LEAN_INTERPRETER_THREADED_DISPATCH
+        // direct-threaded dispatch: jump straight to the implementation of the next instruction
+        static void * const dispatch_table[] = {
+            &&op_Expr, &&op_Scalar, &&op_LitObj, &&op_FAp, &&op_PAp, &&op_Ctor, &&op_Proj, &&op_UProj, &&op_SProj, &&op_Box,
+            &&op_Unbox, &&op_IsShared, &&op_IsTaggedPtr, &&op_Set, &&op_SetTag, &&op_USet, &&op_SSet, &&op_Inc,
+            &&op_Dec, &&op_Del, &&op_Case, &&op_Jmp, &&op_TailCall, &&op_Ret, &&op_Unreachable,
+        };
+        static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) == num_opcodes, "missing opcode in dispatch table"); // NOLINT
+#define INTERP_OP(op) case opcode::op: op_##op: DEBUG_CODE(trace_step(pc);) INTERP_SAMPLE();
+#define INTERP_NEXT() goto *dispatch_table[static_cast<unsigned>(pc->m_op)]
+#else
+#define INTERP_OP(op) case opcode::op: DEBUG_CODE(trace_step(pc);) INTERP_SAMPLE();
+#define INTERP_NEXT() continue
+#endif
         while (true) {
-            DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
-                                  tout() << std::string(m_call_stack.size(), ' ') << format_fn_body_head(b) << "\n";);)
-            switch (fn_body_tag(b)) {
-                case fn_body_kind::VDecl: { // variable declaration
-                    expr const & e = fn_body_vdecl_expr(b);
-                    fn_body const & cont = fn_body_vdecl_cont(b);
-                    // tail recursion?
-                    if (expr_tag(e) == expr_kind::FAp && expr_fap_fun(e) == get_frame().m_fn &&
-                        fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
-                        arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b)) {
-                        // tail recursion! copy argument values to parameter slots and reset `b`
-                        array_ref<arg> const & args = expr_fap_args(e);
-                        // argument and parameter slots may overlap, so first copy arguments to end of stack
-                        size_t old_size = m_arg_stack.size();
-                        for (const auto & arg : args) {
-                            m_arg_stack.push_back(eval_arg(arg));
-                        }
-                        // now copy to parameter slots
-                        for (size_t i = 0; i < args.size(); i++) {
-                            m_arg_stack[get_frame().m_arg_bp + i] = m_arg_stack[old_size + i];
-                        }
-                        m_arg_stack.resize(get_frame().m_arg_bp + args.size());
-                        b = b0;
-                        check_system();
-                        break;
+            switch (pc->m_op) {
+                INTERP_OP(Expr) {
+                    value v = eval_expr(TO_REF(expr, pc->m_ir), pc->m_type);
+                    set_slot(bp, *pc, v);
+                    INTERP_SAMPLE();
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Scalar) {
+                    set_slot(bp, *pc, pc->m_val);
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(LitObj) {
+                    lean_inc(pc->m_ir);
+                    set_slot(bp, *pc, pc->m_ir);
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(FAp) { // saturated ("full") application of top-level function
+                    expr const & e = TO_REF(expr, pc->m_ir);
+                    value v;
+                    if (expr_fap_args(e).size()) {
+                        call_target const * t = get_call_target(c, pc->m_d, expr_fap_fun(e));
+                        v = t ? call(*t, expr_fap_fun(e), expr_fap_args(e)) : call(expr_fap_fun(e), expr_fap_args(e));
+                    } else {
+                        // nullary function ("constant")
+                        v = load(expr_fap_fun(e), pc->m_type);
                     }
-                    value v = eval_expr(fn_body_vdecl_expr(b), fn_body_vdecl_type(b));
-                    // NOTE: `var` must be called *after* `eval_expr` because the stack may get resized and invalidate
-                    // the pointer
-                    var(fn_body_vdecl_var(b)) = v;
-                    DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
-                                          tout() << std::string(m_call_stack.size(), ' ') << "=> x_";
-                                          tout() << fn_body_vdecl_var(b).get_small_value() << " = ";
-                                          print_value(tout(), var(fn_body_vdecl_var(b)), fn_body_vdecl_type(b));
-                                          tout() << "\n";);)
-                    b = fn_body_vdecl_cont(b);
-                    break;
+                    set_slot(bp, *pc, v);
+                    INTERP_SAMPLE();
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(PAp) { // unsaturated (partial) application of top-level function
+                    expr const & e = TO_REF(expr, pc->m_ir);
+                    call_target const * t = get_call_target(c, pc->m_d, expr_pap_fun(e));
+                    value v = t ? mk_pap(t->m_decl, t->m_native, expr_pap_args(e)) : eval_expr(e, pc->m_type);
+                    set_slot(bp, *pc, v);
+                    INTERP_SAMPLE();
+                    pc++;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::JDecl: { // join-point declaration; store in stack slot just like variables
-                    size_t i = get_frame().m_jp_bp + fn_body_jdecl_id(b).get_small_value();
-                    if (i >= m_jp_stack.size()) {
-                        m_jp_stack.resize(i + 1);
+                INTERP_OP(Ctor) {
+                    object * o = alloc_cnstr(pc->m_c, pc->m_d, pc->m_val.m_num);
+                    for (unsigned i = 0; i < pc->m_b; i++) {
+                        cnstr_set(o, i, slot_arg(bp, slots[pc->m_a + i]).m_obj);
                     }
-                    m_jp_stack[i] = &b.get();
-                    b = fn_body_jdecl_cont(b);
-                    break;
+                    set_slot(bp, *pc, o);
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Proj) { // object field access
+                    set_slot(bp, *pc, cnstr_get(slot(bp, pc->m_a).m_obj, pc->m_b));
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(UProj) { // USize field access
+                    set_slot(bp, *pc, static_cast<uint64>(cnstr_get_usize(slot(bp, pc->m_a).m_obj, pc->m_b)));
+                    pc++;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::Set: { // set boxed field of unique reference
-                    object * o = var(fn_body_set_var(b)).m_obj;
+                INTERP_OP(SProj) { // other unboxed field access
+                    object * o = slot(bp, pc->m_a).m_obj;
+                    unsigned offset = pc->m_b;
+                    value v;
+                    switch (pc->m_type) {
+                        case type::Float: v = value::from_float(cnstr_get_float(o, offset)); break;
+                        case type::Float32: v = value::from_float32(cnstr_get_float32(o, offset)); break;
+                        case type::UInt8: v = cnstr_get_uint8(o, offset); break;
+                        case type::UInt16: v = cnstr_get_uint16(o, offset); break;
+                        case type::UInt32: v = cnstr_get_uint32(o, offset); break;
+                        case type::UInt64: v = cnstr_get_uint64(o, offset); break;
+                        case type::USize:
+                        case type::Irrelevant:
+                        case type::Object:
+                        case type::TObject:
+                        case type::Struct:
+                        case type::Union:
+                            throw exception("invalid instruction");
+                    }
+                    set_slot(bp, *pc, v);
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Box) { // box unboxed value
+                    set_slot(bp, *pc, box_t(slot(bp, pc->m_a), static_cast<type>(pc->m_c)));
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Unbox) { // unbox boxed value
+                    set_slot(bp, *pc, unbox_t(slot(bp, pc->m_a).m_obj, pc->m_type));
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(IsShared) {
+                    set_slot(bp, *pc, static_cast<uint64>(!is_exclusive(slot(bp, pc->m_a).m_obj)));
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(IsTaggedPtr) {
+                    set_slot(bp, *pc, static_cast<uint64>(!is_scalar(slot(bp, pc->m_a).m_obj)));
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Set) { // set boxed field of unique reference
+                    object * o = slot(bp, pc->m_a).m_obj;
                     lean_assert(is_exclusive(o));
-                    cnstr_set(o, fn_body_set_idx(b).get_small_value(), eval_arg(fn_body_set_arg(b)).m_obj);
-                    b = fn_body_set_cont(b);
-                    break;
+                    cnstr_set(o, pc->m_b, slot_arg(bp, pc->m_c).m_obj);
+                    pc++;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::SetTag: { // set constructor tag of unique reference
-                    object * o = var(fn_body_set_tag_var(b)).m_obj;
+                INTERP_OP(SetTag) { // set constructor tag of unique reference
+                    object * o = slot(bp, pc->m_a).m_obj;
                     lean_assert(is_exclusive(o));
-                    cnstr_set_tag(o, fn_body_set_tag_cidx(b).get_small_value());
-                    b = fn_body_set_tag_cont(b);
-                    break;
+                    cnstr_set_tag(o, pc->m_b);
+                    pc++;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::USet: { // set USize field of unique reference
-                    object * o = var(fn_body_uset_target(b)).m_obj;
+                INTERP_OP(USet) { // set USize field of unique reference
+                    object * o = slot(bp, pc->m_a).m_obj;
                     lean_assert(is_exclusive(o));
-                    cnstr_set_usize(o, fn_body_uset_idx(b).get_small_value(), var(fn_body_uset_source(b)).m_num);
-                    b = fn_body_uset_cont(b);
-                    break;
+                    cnstr_set_usize(o, pc->m_b, slot(bp, pc->m_c).m_num);
+                    pc++;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::SSet: { // set other unboxed field of unique reference
-                    object * o = var(fn_body_sset_target(b)).m_obj;
-                    size_t offset = fn_body_sset_idx(b).get_small_value() * sizeof(void *) +
-                                    fn_body_sset_offset(b).get_small_value();
-                    value v = var(fn_body_sset_source(b));
+                INTERP_OP(SSet) { // set other unboxed field of unique reference
+                    object * o = slot(bp, pc->m_a).m_obj;
+                    unsigned offset = pc->m_b;
+                    value v = slot(bp, pc->m_c);
                     lean_assert(is_exclusive(o));
-                    switch (fn_body_sset_type(b)) {
+                    switch (pc->m_type) {
                         case type::Float: cnstr_set_float(o, offset, v.m_float); break;
                         case type::Float32: cnstr_set_float32(o, offset, v.m_float32); break;
                         case type::UInt8: cnstr_set_uint8(o, offset, v.m_num); break;
@@ -707,68 +1741,71 @@ private:
                         case type::Union:
                             throw exception(sstream() << "invalid instruction");
                     }
-                    b = fn_body_sset_cont(b);
-                    break;
+                    pc++;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::Inc: // increment reference counter
-                    inc(var(fn_body_inc_var(b)).m_obj, fn_body_inc_val(b).get_small_value());
-                    b = fn_body_inc_cont(b);
-                    break;
-                case fn_body_kind::Dec: { // decrement reference counter
-                    size_t n = fn_body_dec_val(b).get_small_value();
-                    for (size_t i = 0; i < n; i++) {
-                        dec(var(fn_body_dec_var(b)).m_obj);
+                INTERP_OP(Inc) { // increment reference counter
+                    inc(slot(bp, pc->m_a).m_obj, pc->m_b);
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Dec) { // decrement reference counter
+                    for (unsigned i = 0; i < pc->m_b; i++) {
+                        dec(slot(bp, pc->m_a).m_obj);
                     }
-                    b = fn_body_dec_cont(b);
-                    break;
+                    INTERP_SAMPLE();
+                    pc++;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::Del: // delete object of unique reference
-                    lean_free_object(var(fn_body_del_var(b)).m_obj);
-                    b = fn_body_del_cont(b);
-                    break;
-                case fn_body_kind::MData: // metadata; no-op
-                    b = fn_body_mdata_cont(b);
-                    break;
-                case fn_body_kind::Case: { // branch according to constructor tag
-                    array_ref<alt_core> const & alts = fn_body_case_alts(b);
-                    unsigned tag;
-                    value v = var(fn_body_case_var(b));
-                    if (type_is_scalar(fn_body_case_var_type(b))) {
-                        tag = v.m_num;
-                    } else {
-                        tag = lean_obj_tag(v.m_obj);
+                INTERP_OP(Del) { // delete object of unique reference
+                    lean_free_object(slot(bp, pc->m_a).m_obj);
+                    pc++;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Case) { // branch according to constructor tag
+                    value v = slot(bp, pc->m_a);
+                    unsigned tag = type_is_scalar(pc->m_type) ? v.m_num : lean_obj_tag(v.m_obj);
+                    unsigned target = tag < pc->m_c ? targets[pc->m_b + tag] : pc->m_d;
+                    if (target == no_target) {
+                        throw exception("incomplete case");
                     }
-                    for (alt_core const & a : alts) {
-                        switch (alt_core_tag(a)) {
-                            case alt_core_kind::Ctor:
-                                if (tag == ctor_info_tag(alt_core_ctor_info(a)).get_small_value()) {
-                                    b = alt_core_ctor_cont(a);
-                                    goto done;
-                                }
-                                break;
-                            case alt_core_kind::Default:
-                                b = alt_core_default_cont(a);
-                                goto done;
-                        }
+                    pc = base + target;
+                    INTERP_NEXT();
+                }
+                INTERP_OP(Jmp) { // jump to join point, passing arguments in its parameter slots
+                    for (unsigned i = 0; i < pc->m_b; i++) {
+                        slot(bp, slots[pc->m_d + i]) = slot_arg(bp, slots[pc->m_a + i]);
                     }
-                    throw exception("incomplete case");
-                    done: break;
+                    pc = base + pc->m_c;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::Ret:
-                    return eval_arg(fn_body_ret_arg(b));
-                case fn_body_kind::Jmp: { // jump to join-point
-                    fn_body const & jp = *m_jp_stack[get_frame().m_jp_bp + fn_body_jmp_jp(b).get_small_value()];
-                    lean_assert(fn_body_jdecl_params(jp).size() == fn_body_jmp_args(b).size());
-                    for (size_t i = 0; i < fn_body_jdecl_params(jp).size(); i++) {
-                        var(param_var(fn_body_jdecl_params(jp)[i])) = eval_arg(fn_body_jmp_args(b)[i]);
+                INTERP_OP(TailCall) { // tail recursion: copy argument values to parameter slots and restart
+                    // argument and parameter slots may overlap, so first copy arguments to end of stack
+                    size_t old_size = m_arg_stack.size();
+                    for (unsigned i = 0; i < pc->m_b; i++) {
+                        m_arg_stack.push_back(slot_arg(bp, slots[pc->m_a + i]));
                     }
-                    b = fn_body_jdecl_body(jp);
-                    break;
+                    // now copy to parameter slots
+                    for (unsigned i = 0; i < pc->m_b; i++) {
+                        m_arg_stack[bp + i] = m_arg_stack[old_size + i];
+                    }
+                    m_arg_stack.resize(old_size);
+                    check_system();
+                    pc = base;
+                    INTERP_NEXT();
                 }
-                case fn_body_kind::Unreachable:
+                INTERP_OP(Ret) {
+                    return slot_arg(bp, pc->m_a);
+                }
+                INTERP_OP(Unreachable) {
                     throw exception("unreachable code");
+                }
             }
+            lean_unreachable();
         }
+#undef INTERP_OP
+#undef INTERP_NEXT
+#undef INTERP_SAMPLE
     }
 
     // specify argument base pointer explicitly because we've usually already pushed some function arguments
@@ -782,12 +1819,11 @@ private:
                        }
                        tout() << "\n";);
         });
-        m_call_stack.emplace_back(decl_fun_id(d), arg_bp, m_jp_stack.size());
+        m_call_stack.emplace_back(decl_fun_id(d), arg_bp);
     }
 
     void pop_frame(value DEBUG_CODE(r), type DEBUG_CODE(t)) {
         m_arg_stack.resize(get_frame().m_arg_bp);
-        m_jp_stack.resize(get_frame().m_jp_bp);
         m_call_stack.pop_back();
         DEBUG_CODE({
             lean_trace(name({"interpreter", "call"}),
@@ -799,41 +1835,94 @@ private:
     }
 
     /** \brief Return cached lookup result for given unmangled function name in the current binary. */
-    symbol_cache_entry lookup_symbol(name const & fn) {
-        if (symbol_cache_entry const * e = m_symbol_cache.find(fn)) {
-            return *e;
-        }
+    static native_symbol_cache_entry lookup_native_symbol(name const & fn) {
         std::shared_lock<std::shared_timed_mutex> lock(*g_native_symbol_cache_mutex);
         if (native_symbol_cache_entry const * ne = g_native_symbol_cache->find(fn)) {
-            symbol_cache_entry e_new { get_decl(fn), *ne };
-            m_symbol_cache.insert(fn, e_new);
-            return e_new;
+            return *ne;
         }
         lock.unlock();
         std::unique_lock<std::shared_timed_mutex> unique_lock(*g_native_symbol_cache_mutex);
         if (native_symbol_cache_entry const * ne = g_native_symbol_cache->find(fn)) {
-            symbol_cache_entry e_new { get_decl(fn), *ne };
-            m_symbol_cache.insert(fn, e_new);
-            return e_new;
+            return *ne;
         }
-        symbol_cache_entry e_new { get_decl(fn), {nullptr, false} };
+        native_symbol_cache_entry e_new {nullptr, false, nullptr};
+        string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+        string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+        // check for boxed version first
+        if (void *p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
+            e_new.m_addr = p_boxed;
+            e_new.m_boxed = true;
+            // not present for `extern` declarations implemented in C
+            e_new.m_unboxed_addr = lookup_symbol_in_cur_exe(mangled.data());
+        } else if (void *p = lookup_symbol_in_cur_exe(mangled.data())) {
+            // if there is no boxed version, there are no unboxed parameters, so use default version
+            e_new.m_addr = p;
+            e_new.m_unboxed_addr = p;
+        }
+        g_native_symbol_cache->insert(fn, e_new);
+        return e_new;
+    }
+
+    /** \brief Return cached declaration and native code for given unmangled function name. */
+    symbol_cache_entry lookup_symbol(name const & fn) {
+        if (symbol_cache_entry const * e = m_symbol_cache.find(fn)) {
+            return *e;
+        }
+        symbol_cache_entry e_new { get_decl(fn), {nullptr, false, nullptr} };
+        // NOTE: the process-wide native symbol cache is only consulted (and filled) if we actually want native code, so
+        // that it is independent of `interpreter.prefer_native`
         if (m_prefer_native || decl_tag(e_new.m_decl) == decl_kind::Extern || has_init_attribute(m_env, fn)) {
-            string_ref mangled = name_mangle(fn, *g_mangle_prefix);
-            string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
-            // check for boxed version first
-            if (void *p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
-                e_new.m_native.m_addr = p_boxed;
-                e_new.m_native.m_boxed = true;
-            } else if (void *p = lookup_symbol_in_cur_exe(mangled.data())) {
-                // if there is no boxed version, there are no unboxed parameters, so use default version
-                e_new.m_native.m_addr = p;
-            }
+            e_new.m_native = lookup_native_symbol(fn);
         }
-        g_native_symbol_cache->insert(fn, e_new.m_native);
         m_symbol_cache.insert(fn, e_new);
         return e_new;
     }
 
+    /** \brief Return true if `o` does not reference interpreter closures or mutable state. Interpreter closures
+        capture the environment and options of the interpreter that created them, so sharing them would leak these. */
+    static bool is_shareable_constant(object * o) {
+        buffer<object *> todo;
+        std::unordered_set<object *> visited;
+        todo.push_back(o);
+        while (!todo.empty()) {
+            object * o = todo.back();
+            todo.pop_back();
+            if (is_scalar(o) || lean_is_persistent(o) || !visited.insert(o).second) {
+                continue;
+            }
+            uint8_t tag = lean_ptr_tag(o);
+            if (tag <= LeanMaxCtorTag) {
+                for (unsigned i = 0; i < lean_ctor_num_objs(o); i++) {
+                    todo.push_back(lean_ctor_get(o, i));
+                }
+                continue;
+            }
+            switch (tag) {
+                case LeanClosure:
+                    if (is_stub(lean_closure_fun(o))) {
+                        return false;
+                    }
+                    for (unsigned i = 0; i < lean_closure_num_fixed(o); i++) {
+                        todo.push_back(lean_closure_get(o, i));
+                    }
+                    break;
+                case LeanArray:
+                    for (size_t i = 0; i < lean_array_size(o); i++) {
+                        todo.push_back(lean_array_get_core(o, i));
+                    }
+                    break;
+                case LeanScalarArray:
+                case LeanString:
+                case LeanMPZ:
+                    break;
+                default:
+                    // thunks, tasks, references, external objects, ...
+                    return false;
+            }
+        }
+        return true;
+    }
+
     /** \brief Retrieve theorem_ai declaration from elab_environment. */
     decl get_decl(name const & fn) {
         option_ref<decl> d = find_ir_decl(m_env, fn);
@@ -884,10 +1973,28 @@ private:
             // We don't know whether `[init]` decls can be re-executed, so let's not.
             throw exception(sstream() << "cannot evaluate `[init]` declaration '" << fn << "' in the same module");
         }
+        bool persistent = lean_is_persistent(e.m_decl.raw());
+        if (persistent) {
+            std::shared_lock<std::shared_timed_mutex> lock(*g_persistent_cache_mutex);
+            auto it = g_persistent_constant_cache->find(e.m_decl.raw());
+            if (it != g_persistent_constant_cache->end()) {
+                // persistent, so no `inc` needed
+                return it->second.m_val;
+            }
+        }
         push_frame(e.m_decl, m_arg_stack.size());
         lean_always_assert(decl_tag(e.m_decl) == decl_kind::Fun);
-        value r = eval_body(decl_fun_body(e.m_decl));
+        value r = run(get_code(e.m_decl));
         pop_frame(r, decl_type(e.m_decl));
+        if (persistent && (type_is_scalar(t) || is_shareable_constant(r.m_obj))) {
+            // like closed terms in native code, the value is shared and never freed
+            if (!type_is_scalar(t)) {
+                mark_persistent(r.m_obj);
+            }
+            std::unique_lock<std::shared_timed_mutex> lock(*g_persistent_cache_mutex);
+            g_persistent_constant_cache->emplace(e.m_decl.raw(), constant_cache_entry { type_is_scalar(t), r });
+            return r;
+        }
         if (!type_is_scalar(t)) {
             inc(r.m_obj);
         }
@@ -895,6 +2002,288 @@ private:
         return r;
     }
 
+    /** \brief Return the tiered execution state of the non-persistent declaration `d`. */
+    static std::shared_ptr<tier_up_entry> get_tier_up_entry(decl const & d) {
+        std::lock_guard<std::mutex> lock(*g_tier_up_mutex);
+        std::shared_ptr<tier_up_entry> & e = (*g_tier_up_entries)[d.raw()];
+        if (!e) {
+            e = std::make_shared<tier_up_entry>(d);
+        }
+        return e;
+    }
+
+    /** \brief Mark `e` as failed and remove it from `g_tier_up_entries`; call sites already resolved to it keep it.
+        Requires `g_tier_up_mutex` to be held. */
+    static void fail_tier_up(tier_up_entry & e) {
+        e.m_state.store(tier_up_entry::state::Failed, std::memory_order_release);
+        auto it = g_tier_up_entries->find(e.m_decl.raw());
+        if (it != g_tier_up_entries->end() && it->second.get() == &e) {
+            g_tier_up_entries->erase(it);
+        }
+    }
+
+    /** \brief Remove the entries of declarations that have been replaced in `m_env` and that no call site or job uses
+        anymore. */
+    void prune_tier_up_entries() {
+        std::lock_guard<std::mutex> lock(*g_tier_up_mutex);
+        auto it = g_tier_up_entries->begin();
+        while (it != g_tier_up_entries->end()) {
+            tier_up_entry const & e = *it->second;
+            if (it->second.use_count() == 1 && e.m_state.load(std::memory_order_acquire) != tier_up_entry::state::Compiling) {
+                option_ref<decl> d = find_ir_decl(m_env, decl_fun_id(e.m_decl));
+                if (d && d.get()->raw() != e.m_decl.raw()) {
+                    it = g_tier_up_entries->erase(it);
+                    continue;
+                }
+            }
+            it++;
+        }
+    }
+
+    /** \brief Count a call of the declaration of `e`. Return its native code if it has been tiered up. */
+    native_symbol_cache_entry const * tier_up(tier_up_entry & e) {
+        switch (e.m_state.load(std::memory_order_acquire)) {
+            case tier_up_entry::state::Native:
+                return &e.m_native;
+            case tier_up_entry::state::Failed:
+                return nullptr;
+            case tier_up_entry::state::Compiling:
+                if (++e.m_calls % tier_up_poll_interval == 0) {
+                    poll_tier_up_jobs();
+                    if (e.m_state.load(std::memory_order_acquire) == tier_up_entry::state::Native) {
+                        return &e.m_native;
+                    }
+                }
+                return nullptr;
+            case tier_up_entry::state::Interpreted:
+                if (++e.m_calls >= m_tier_up_threshold) {
+                    start_tier_up(e);
+                }
+                return nullptr;
+        }
+        lean_unreachable();
+    }
+
+    /** \brief Start compiling the declaration of `e` together with all declarations of the current module it uses,
+        which must not be constants as these are only initialized by the module initializer. Declarations of other
+        modules must have native code already. */
+    void start_tier_up(tier_up_entry & e) {
+        tier_up_entry::state expected = tier_up_entry::state::Interpreted;
+        if (!e.m_state.compare_exchange_strong(expected, tier_up_entry::state::Compiling)) {
+            // another thread was faster
+            return;
+        }
+        buffer<decl> todo;
+        buffer<name> fns;
+        std::unordered_set<object *> visited;
+        todo.push_back(e.m_decl);
+        visited.insert(e.m_decl.raw());
+        while (!todo.empty()) {
+            decl d = todo.back();
+            todo.pop_back();
+            fns.push_back(decl_fun_id(d));
+            buffer<name> callees;
+            // the boxed version is what the interpreter calls, and what closures point to
+            callees.push_back(name(decl_fun_id(d), g_boxed_suffix->data()));
+            for (instr const & i : get_code(d).m_instrs) {
+                if (i.m_op == opcode::FAp) {
+                    callees.push_back(expr_fap_fun(TO_REF(expr, i.m_ir)));
+                } else if (i.m_op == opcode::PAp) {
+                    callees.push_back(expr_pap_fun(TO_REF(expr, i.m_ir)));
+                }
+            }
+            for (name const & fn : callees) {
+                option_ref<decl> cd = find_ir_decl(m_env, fn);
+                if (!cd) {
+                    // no boxed version
+                    continue;
+                }
+                decl c = cd.get().value();
+                if (!visited.insert(c.raw()).second) {
+                    continue;
+                }
+                bool ok;
+                if (lean_is_persistent(c.raw())) {
+                    // `extern` declarations are implemented in the runtime, possibly inline in `lean.h`
+                    ok = decl_tag(c) == decl_kind::Extern || lookup_native_symbol(fn).m_addr;
+                } else {
+                    ok = decl_tag(c) == decl_kind::Fun && decl_params(c).size() > 0;
+                    todo.push_back(c);
+                }
+                if (!ok) {
+                    lean_trace(name({"interpreter", "tier_up"}),
+                               tout() << "cannot compile '" << decl_fun_id(e.m_decl) << "' to native code: it uses '"
+                                      << fn << "', which neither has native code nor can be compiled with it\n";);
+                    std::lock_guard<std::mutex> lock(*g_tier_up_mutex);
+                    fail_tier_up(e);
+                    return;
+                }
+            }
+        }
+        tier_up_job job;
+        for (name const & fn : fns) {
+            std::shared_ptr<tier_up_entry> fe = get_tier_up_entry(get_decl(fn));
+            expected = tier_up_entry::state::Interpreted;
+            fe->m_state.compare_exchange_strong(expected, tier_up_entry::state::Compiling);
+            job.m_entries.push_back(fe);
+        }
+        object * r = lean_ir_compile_decls_to_shared_lib(m_env.to_obj_arg(), array_ref<name>(fns).steal(), io_mk_world());
+        job.m_task = io_result_get_value(r);
+        inc(job.m_task);
+        dec(r);
+        std::lock_guard<std::mutex> lock(*g_tier_up_mutex);
+        g_tier_up_jobs->push_back(job);
+    }
+
+    /** \brief Load the shared libraries of finished compilations. */
+    static void poll_tier_up_jobs() {
+        std::lock_guard<std::mutex> lock(*g_tier_up_mutex);
+        auto it = g_tier_up_jobs->begin();
+        while (it != g_tier_up_jobs->end()) {
+            // `IO.TaskState.finished`
+            if (lean_io_get_task_state_core(it->m_task) != 2) {
+                it++;
+                continue;
+            }
+            object * r = task_get(it->m_task);
+            // `Except IO.Error String`
+            void * lib = nullptr;
+            if (cnstr_tag(r) == 1) {
+                char const * path = string_cstr(cnstr_get(r, 0));
+                lib = load_shared_lib(path);
+#ifdef LEAN_WINDOWS
+                if (!lib)
+#endif
+                std::remove(path);
+                if (!lib) {
+                    lean_trace(name({"interpreter", "tier_up"}), tout() << "failed to load '" << path << "'\n";);
+                }
+            } else {
+                inc(cnstr_get(r, 0));
+                string_ref msg(lean_io_error_to_string(cnstr_get(r, 0)));
+                lean_trace(name({"interpreter", "tier_up"}), tout() << msg.data() << "\n";);
+            }
+            for (std::shared_ptr<tier_up_entry> const & e : it->m_entries) {
+                if (e->m_state.load(std::memory_order_acquire) == tier_up_entry::state::Native) {
+                    // compiled by an earlier job; `m_native` may be in use
+                    continue;
+                }
+                if (lib) {
+                    string_ref mangled = name_mangle(decl_fun_id(e->m_decl), *g_mangle_prefix);
+                    string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+                    e->m_native.m_unboxed_addr = lookup_symbol_in_lib(lib, mangled.data());
+                    if (void * p_boxed = lookup_symbol_in_lib(lib, boxed_mangled.data())) {
+                        e->m_native.m_addr = p_boxed;
+                        e->m_native.m_boxed = true;
+                    } else {
+                        e->m_native.m_addr = e->m_native.m_unboxed_addr;
+                    }
+                }
+                if (e->m_native.m_addr) {
+                    lean_trace(name({"interpreter", "tier_up"}),
+                               tout() << "calling native code of '" << decl_fun_id(e->m_decl) << "'\n";);
+                    e->m_state.store(tier_up_entry::state::Native, std::memory_order_release);
+                    g_tier_up_num_native.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    fail_tier_up(*e);
+                }
+            }
+            dec(it->m_task);
+            it = g_tier_up_jobs->erase(it);
+        }
+    }
+
+    /** \brief Return the resolved target of call site `site` of `c` calling `fn`, or `nullptr` if the resolution cannot
+        be cached.
+
+        The bytecode of persistent declarations is shared by all interpreters, which may resolve non-persistent names
+        differently, so there we only cache targets that are persistent declarations themselves. */
+    call_target const * get_call_target(code const & c, unsigned site, name const & fn) {
+        std::atomic<call_target *> & entry = c.m_call_sites[site].m_target[m_prefer_native];
+        if (call_target const * t = entry.load(std::memory_order_acquire)) {
+            return t;
+        }
+        symbol_cache_entry e = lookup_symbol(fn);
+        if (lean_is_persistent(c.m_decl.raw()) && !lean_is_persistent(e.m_decl.raw())) {
+            return nullptr;
+        }
+        std::unique_ptr<call_target> t(new call_target(e.m_decl, e.m_native));
+        if (!e.m_native.m_addr && decl_tag(e.m_decl) == decl_kind::Fun) {
+            t->m_code = &get_code(e.m_decl);
+            if (m_tier_up_threshold && !lean_is_persistent(e.m_decl.raw())) {
+                t->m_tier_up = get_tier_up_entry(e.m_decl);
+            }
+        }
+        call_target * expected = nullptr;
+        if (entry.compare_exchange_strong(expected, t.get(), std::memory_order_acq_rel)) {
+            return t.release();
+        }
+        // another thread was faster
+        return expected;
+    }
+
+    /** \brief Call the resolved target `t` of `fn`. */
+    value call(call_target const & t, name const & fn, array_ref<arg> const & args) {
+        size_t old_size = m_arg_stack.size();
+        value r;
+        native_symbol_cache_entry const * native = t.m_native.m_addr ? &t.m_native : nullptr;
+        if (!native && t.m_tier_up) {
+            native = tier_up(*t.m_tier_up);
+        }
+        if (native) {
+#ifdef LEAN_INTERPRETER_UNBOXED_CALLS
+            // `m_args` describes `m_native`, not tiered-up code
+            if (native == &t.m_native && t.m_args == native_args::Words) {
+                uint64 args2[max_unboxed_args];
+                for (size_t i = 0; i < args.size(); i++) {
+                    args2[i] = eval_arg(args[i]).m_num;
+                }
+                push_frame(t.m_decl, old_size);
+                r = call_native_unboxed(t.m_native.m_unboxed_addr, t.m_ret, args.size(), args2);
+                pop_frame(r, t.m_type);
+                return r;
+            } else if (native == &t.m_native && t.m_args == native_args::Floats) {
+                double args2[max_unboxed_args];
+                for (size_t i = 0; i < args.size(); i++) {
+                    args2[i] = eval_arg(args[i]).m_float;
+                }
+                push_frame(t.m_decl, old_size);
+                r = call_native_unboxed(t.m_native.m_unboxed_addr, t.m_ret, args.size(), args2);
+                pop_frame(r, t.m_type);
+                return r;
+            }
+#endif
+            object ** args2 = static_cast<object **>(LEAN_ALLOCA(args.size() * sizeof(object *))); // NOLINT
+            for (size_t i = 0; i < args.size(); i++) {
+                args2[i] = box_t(eval_arg(args[i]), t.m_param_types[i]);
+                if (native->m_boxed && t.m_param_borrow[i]) {
+                    // see `call(name const &, array_ref<arg> const &)`
+                    inc(args2[i]);
+                }
+            }
+            push_frame(t.m_decl, old_size);
+            object * o = curry(native->m_addr, args.size(), args2);
+            if (type_is_scalar(t.m_type)) {
+                lean_assert(native->m_boxed);
+                r = unbox_t(o, t.m_type);
+                lean_dec(o);
+            } else {
+                r = o;
+            }
+        } else if (t.m_code) {
+            for (const auto & arg : args) {
+                m_arg_stack.push_back(eval_arg(arg));
+            }
+            push_frame(t.m_decl, old_size);
+            r = run(*t.m_code);
+        } else {
+            // missing native implementation of external declaration; let the uncached path report it
+            return call(fn, args);
+        }
+        pop_frame(r, t.m_type);
+        return r;
+    }
+
     value call(name const & fn, array_ref<arg> const & args) {
         size_t old_size = m_arg_stack.size();
         value r;
@@ -937,7 +2326,7 @@ private:
                 m_arg_stack.push_back(eval_arg(arg));
             }
             push_frame(e.m_decl, old_size);
-            r = eval_body(decl_fun_body(e.m_decl));
+            r = run(get_code(e.m_decl));
         }
         pop_frame(r, decl_type(e.m_decl));
         return r;
@@ -951,7 +2340,7 @@ private:
             m_arg_stack.push_back(args[3 + i]);
         }
         push_frame(d, old_size);
-        object * r = eval_body(decl_fun_body(d)).m_obj;
+        object * r = run(get_code(d)).m_obj;
         pop_frame(r, type::TObject);
         return r;
     }
@@ -983,7 +2372,7 @@ private:
     static object * stub_15_aux(object * x_1, object * x_2, object * x_3, object * x_4, object * x_5, object * x_6, object * x_7, object * x_8, object * x_9, object * x_10, object * x_11, object * x_12, object * x_13, object * x_14, object * x_15) { object * args[] = { x_1, x_2, x_3, x_4, x_5, x_6, x_7, x_8, x_9, x_10, x_11, x_12, x_13, x_14, x_15 }; return interpreter::stub_m_aux(args); }
     static object * stub_16_aux(object * x_1, object * x_2, object * x_3, object * x_4, object * x_5, object * x_6, object * x_7, object * x_8, object * x_9, object * x_10, object * x_11, object * x_12, object * x_13, object * x_14, object * x_15, object * x_16) { object * args[] = { x_1, x_2, x_3, x_4, x_5, x_6, x_7, x_8, x_9, x_10, x_11, x_12, x_13, x_14, x_15, x_16 }; return interpreter::stub_m_aux(args); }
 
-    void * get_stub(unsigned params) {
+    static void * get_stub(unsigned params) {
         switch (params) {
             case 0: lean_unreachable();
             case 1: return reinterpret_cast<void *>(stub_1_aux);
@@ -1005,14 +2394,59 @@ private:
             default: return reinterpret_cast<void *>(stub_m_aux);
         }
     }
+
+    static bool is_stub(void * f) {
+        for (unsigned i = 1; i <= 17; i++) {
+            if (f == get_stub(i)) {
+                return true;
+            }
+        }
+        return false;
+    }
 public:
+    /** \brief Wait for the tier-up compilations started so far, and load their libraries. */
+    static void wait_tier_up_jobs() {
+        std::vector<object_ref> tasks;
+        {
+            std::lock_guard<std::mutex> lock(*g_tier_up_mutex);
+            for (tier_up_job const & job : *g_tier_up_jobs) {
+                tasks.push_back(object_ref(job.m_task, true));
+            }
+        }
+        for (object_ref const & t : tasks) {
+            task_get(t.raw());
+        }
+        poll_tier_up_jobs();
+    }
+
     explicit interpreter(elab_environment const & env, options const & opts) : m_env(env), m_opts(opts) {
         m_prefer_native = opts.get_bool(*g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE);
+#ifdef LEAN_EMSCRIPTEN
+        m_tier_up_threshold = 0;
+#else
+        m_tier_up_threshold = opts.get_unsigned(*g_interpreter_tier_up_threshold, 0);
+        if (m_tier_up_threshold) {
+            prune_tier_up_entries();
+        }
+#endif
+#if defined(LEAN_MULTI_THREAD)
+        m_profile = opts.get_bool(*g_interpreter_profiler, false);
+#else
+        m_profile = false;
+#endif
+        if (m_profile) {
+            g_profiler->start(opts.get_unsigned(*g_interpreter_profiler_interval, LEAN_DEFAULT_INTERPRETER_PROFILER_INTERVAL),
+                              opts.get_string(*g_interpreter_profiler_output, ""));
+        }
+        m_profiler_tick = g_profiler_tick.load(std::memory_order_relaxed);
     }
 
     interpreter(interpreter const &) = delete;
 
     ~interpreter() {
+        if (m_profile) {
+            g_profiler->stop();
+        }
         for_each(m_constant_cache, [](name const &, constant_cache_entry const & e) {
             if (!e.m_is_scalar) {
                 dec(e.m_val.m_obj);
@@ -1167,6 +2601,15 @@ extern "C" LEAN_EXPORT object * lean_run_mod_init(object * mod, object *) {
     }
 }
 
+extern "C" LEAN_EXPORT object * lean_ir_tier_up_num_native(object *) {
+    return io_result_mk_ok(mk_nat_obj(g_tier_up_num_native.load(std::memory_order_relaxed)));
+}
+
+extern "C" LEAN_EXPORT object * lean_ir_wait_tier_up(object *) {
+    interpreter::wait_tier_up_jobs();
+    return io_result_mk_ok(box(0));
+}
+
 extern "C" LEAN_EXPORT object * lean_run_init(object * env, object * opts, object * decl, object * init_decl, object *) {
     return interpreter::with_interpreter<object *>(TO_REF(elab_environment, env), TO_REF(options, opts), TO_REF(name, decl), [&](interpreter & interp) {
         return interp.run_init(TO_REF(name, decl), TO_REF(name, init_decl));
@@ -1184,19 +2627,51 @@ void initialize_ir_interpreter() {
     ir::g_interpreter_prefer_native = new name({"interpreter", "prefer_native"});
     ir::g_init_globals = new name_map<object *>();
     register_bool_option(*ir::g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE, "(interpreter) whether to use precompiled code where available");
+    ir::g_interpreter_tier_up_threshold = new name({"interpreter", "tier_up_threshold"});
+    register_unsigned_option(*ir::g_interpreter_tier_up_threshold, 0, "(interpreter) number of calls after which a function of the current module is compiled to native code using the bundled C compiler (0: never)");
+    ir::g_interpreter_profiler = new name({"interpreter", "profiler"});
+    register_bool_option(*ir::g_interpreter_profiler, false, "(interpreter) sample the call stack of interpreted code periodically and report where time is spent");
+    ir::g_interpreter_profiler_interval = new name({"interpreter", "profiler", "interval"});
+    register_unsigned_option(*ir::g_interpreter_profiler_interval, LEAN_DEFAULT_INTERPRETER_PROFILER_INTERVAL, "(interpreter) microseconds between two samples of `interpreter.profiler`");
+    ir::g_interpreter_profiler_output = new name({"interpreter", "profiler", "output"});
+    register_string_option(*ir::g_interpreter_profiler_output, "", "(interpreter) file to append the samples of `interpreter.profiler` to, in the folded stacks format of flamegraph.pl; if empty, a summary is printed instead");
+    ir::g_profiler = new ir::interpreter_profiler();
+    register_trace_class({"interpreter"});
+    register_trace_class({"interpreter", "tier_up"});
     DEBUG_CODE({
-        register_trace_class({"interpreter"});
         register_trace_class({"interpreter", "call"});
         register_trace_class({"interpreter", "step"});
     });
     ir::g_native_symbol_cache = new name_map<ir::native_symbol_cache_entry>();
     ir::g_native_symbol_cache_mutex = new std::shared_timed_mutex();
+    ir::g_persistent_cache_mutex = new std::shared_timed_mutex();
+    ir::g_persistent_code_cache = new std::unordered_map<object *, std::unique_ptr<ir::code>>();
+    ir::g_persistent_constant_cache = new std::unordered_map<object *, ir::constant_cache_entry>();
+    register_compacted_region_free_hook(ir::drop_region_entries);
+    ir::g_tier_up_mutex = new std::mutex();
+    ir::g_tier_up_entries = new std::unordered_map<object *, std::shared_ptr<ir::tier_up_entry>>();
+    ir::g_tier_up_jobs = new std::vector<ir::tier_up_job>();
 }
 
 void finalize_ir_interpreter() {
+    for (ir::tier_up_job const & job : *ir::g_tier_up_jobs) {
+        dec(job.m_task);
+    }
+    delete ir::g_tier_up_jobs;
+    delete ir::g_tier_up_entries;
+    delete ir::g_tier_up_mutex;
+    // values of persistent constants are persistent themselves and thus not freed
+    delete ir::g_persistent_constant_cache;
+    delete ir::g_persistent_code_cache;
+    delete ir::g_persistent_cache_mutex;
     delete ir::g_native_symbol_cache_mutex;
     delete ir::g_native_symbol_cache;
     delete ir::g_init_globals;
+    delete ir::g_profiler;
+    delete ir::g_interpreter_profiler_output;
+    delete ir::g_interpreter_profiler_interval;
+    delete ir::g_interpreter_profiler;
+    delete ir::g_interpreter_tier_up_threshold;
     delete ir::g_interpreter_prefer_native;
     delete ir::g_boxed_mangled_suffix;
     delete ir::g_boxed_suffix;
@@ -8,12 +8,14 @@ Author: Leonardo de Moura
 #include "runtime/flet.h"
 #include "kernel/instantiate.h"
 #include "kernel/for_each_fn.h"
+#include "kernel/replace_fn.h"
 #include "kernel/abstract.h"
 #include "kernel/inductive.h"
 #include "kernel/trace.h"
 #include "library/class.h"
 #include "library/compiler/util.h"
 #include "library/compiler/csimp.h"
+#include "library/compiler/eager_lambda_lifting.h"
 
 namespace theorem_ai {
 extern "C" uint8 lean_has_specialize_attribute(object* env, object* n);
@@ -1052,6 +1054,28 @@ class specialize_fn {
         return n;
     }
 
+    expr normalize_cache_key(expr const & e, unsigned & budget) {
+        return replace(e, [&](expr const & c, unsigned) {
+            if (!is_constant(c) || budget == 0 || !is_elambda_lifting_name(const_name(c)))
+                return none_expr();
+            optional<constant_info> info = env().find(mk_cstage1_name(const_name(c)));
+            if (!info || !info->is_definition())
+                return none_expr();
+            budget--;
+            return some_expr(normalize_cache_key(instantiate_value_lparams(*info, const_levels(c)), budget));
+        });
+    }
+
+    /* Replace the auxiliary definitions created by eager lambda lifting in the key `e` of `cache_specialization` by
+       their code. Their names depend on the declaration (and thus module) they were lifted from, so this makes keys for
+       the same instance arguments equal in different modules. The cache is persisted in .olean files, so a module can
+       then reuse the specializations of its imports instead of generating its own copy.
+       We unfold at most a few such definitions to keep keys small. */
+    expr normalize_cache_key(expr const & e) {
+        unsigned budget = 8;
+        return normalize_cache_key(e, budget);
+    }
+
     optional<expr> specialize(expr const & fn, buffer<expr> const & args, spec_ctx & ctx) {
         if (!is_specialize_candidate(fn, args))
             return none_expr();
@@ -1116,7 +1140,7 @@ class specialize_fn {
            This file will be deleted. So, it is not worth designing a better caching scheme.
            TODO: when we reimplement this module in theorem_ai, we should have a better caching heuristic. */
         if (gcache_enabled && ctx.m_params.size() == 0) {
-            key = mk_app(fn, gcache_key_args);
+            key = normalize_cache_key(mk_app(fn, gcache_key_args));
             if (optional<name> it = get_cached_specialization(env(), key)) {
                 lean_trace(name({"compiler", "specialize"}), tout() << "get_cached_specialization [" << ctx.m_params.size() << "]: " << *it << "\n";
                            unsigned i = 0;
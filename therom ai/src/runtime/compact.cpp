@@ -507,8 +507,22 @@ extern "C" LEAN_EXPORT usize lean_compacted_region_size(usize region) {
     return reinterpret_cast<compacted_region *>(region)->size();
 }
 
+typedef void (*region_free_hook)(void const * begin, void const * end);
+static std::vector<region_free_hook> * g_region_free_hooks = nullptr;
+
+void register_compacted_region_free_hook(region_free_hook fn) {
+    if (!g_region_free_hooks)
+        g_region_free_hooks = new std::vector<region_free_hook>();
+    g_region_free_hooks->push_back(fn);
+}
+
 extern "C" LEAN_EXPORT obj_res lean_compacted_region_free(usize region, object *) {
-    delete reinterpret_cast<compacted_region *>(region);
+    compacted_region * r = reinterpret_cast<compacted_region *>(region);
+    if (g_region_free_hooks) {
+        for (region_free_hook fn : *g_region_free_hooks)
+            fn(r->begin(), r->end());
+    }
+    delete r;
     return lean_io_result_mk_ok(lean_box(0));
 }
 }
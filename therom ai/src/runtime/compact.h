@@ -90,5 +90,12 @@ public:
     object * read();
     bool is_memory_mapped() const { return m_is_mmap; }
     size_t size() const { return m_size; }
+    void const * begin() const { return m_begin; }
+    void const * end() const { return m_end; }
 };
+
+/* Register `fn` to be called with the bounds `[begin, end)` of the objects of a compacted region before the region is
+   freed. Caches that key objects by address, and may thus hold pointers into the region, use it to drop their entries.
+   Should be called at initialization time only. */
+LEAN_EXPORT void register_compacted_region_free_hook(void (*fn)(void const * begin, void const * end));
 }
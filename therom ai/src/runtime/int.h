@@ -34,4 +34,13 @@ static_assert(sizeof(usize) == sizeof(isize), "unexpected size difference usize/
 static_assert(sizeof(usize) == 4 || sizeof(usize) == 8, "usize is neither 32 nor 64 bit"); // NOLINT
                                                                                            //
 
+#if defined(__SIZEOF_INT128__)
+// Native 128-bit integers, used by the fixed-width fast paths of the `Nat` and `Int` primitives.
+#define LEAN_HAS_INT128
+typedef __int128          int128;
+typedef unsigned __int128 uint128;
+static_assert(sizeof(int128) == 16,  "unexpected int128 size");  // NOLINT
+static_assert(sizeof(uint128) == 16, "unexpected uint128 size"); // NOLINT
+#endif
+
 }
@@ -57,6 +57,15 @@ void check_interrupted() {
     }
 }
 
+interrupt_state capture_interrupt_state() {
+    if (g_cancel_tk)
+        mark_mt(g_cancel_tk);
+    return interrupt_state{g_heartbeat, g_max_heartbeat, g_cancel_tk};
+}
+
+LEAN_EXPORT scope_interrupt_state::scope_interrupt_state(interrupt_state const & s):
+    m_heartbeat(s.m_heartbeat), m_max_heartbeat(s.m_max_heartbeat), m_cancel_tk(s.m_cancel_tk) {}
+
 void check_system(char const * component_name, bool do_check_interrupted) {
     check_stack(component_name);
     check_memory(component_name);
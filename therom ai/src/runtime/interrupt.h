@@ -53,6 +53,25 @@ public:
 */
 LEAN_EXPORT void check_interrupted();
 
+/** \brief Heartbeats, heartbeat limit, and cancel token of a thread. Tasks doing work on behalf of a thread that
+    waits for them install its state with `scope_interrupt_state`, so that they are interrupted like the thread. */
+struct interrupt_state {
+    size_t        m_heartbeat;
+    size_t        m_max_heartbeat;
+    lean_object * m_cancel_tk; // borrowed from the thread, `nullptr` if unset
+};
+
+/** \brief Return the state of the current thread. The cancel token is marked as multi-threaded. */
+LEAN_EXPORT interrupt_state capture_interrupt_state();
+
+class LEAN_EXPORT scope_interrupt_state {
+    scope_heartbeat     m_heartbeat;
+    scope_max_heartbeat m_max_heartbeat;
+    scope_cancel_tk     m_cancel_tk;
+public:
+    LEAN_EXPORT scope_interrupt_state(interrupt_state const & s);
+};
+
 /**
    \brief Check system resources: stack, memory, and (if `do_check_interrupted` is true) heartbeat
    limit and interrupt flag.
@@ -596,18 +596,32 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_write(b_obj_arg h, b_obj_arg
     }
 }
 
+#ifndef LEAN_WINDOWS
+// Line buffer reused by `Handle.getLine` on the current thread.
+struct get_line_buffer {
+    char * m_data     = nullptr;
+    size_t m_capacity = 0;
+    ~get_line_buffer() { free(m_data); }
+};
+MK_THREAD_LOCAL_GET_DEF(get_line_buffer, get_get_line_buffer);
+// Buffers grown beyond this size by an unusually long line are released again after use.
+static constexpr size_t g_get_line_buffer_max_retained = 1024 * 1024;
+#endif
+
 /* Handle.getLine : (@& Handle) → IO Unit */
 extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_get_line(b_obj_arg h, obj_arg /* w */) {
     FILE * fp = io_get_handle(h);
-
+#ifdef LEAN_WINDOWS
     std::string result;
     int c; // Note: int, not char, required to handle EOF
-    while ((c = std::fgetc(fp)) != EOF) {
+    _lock_file(fp);
+    while ((c = _getc_nolock(fp)) != EOF) {
         result.push_back(c);
         if (c == '\n') {
             break;
         }
     }
+    _unlock_file(fp);
 
     if (std::ferror(fp)) {
         return io_result_mk_error(decode_io_error(errno, nullptr));
@@ -618,6 +632,33 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_get_line(b_obj_arg h, obj_arg
         obj_res ret = io_result_mk_ok(mk_string(result));
         return ret;
     }
+#else
+    // `getline` searches the stdio buffer for the line break with `memchr` and copies whole
+    // buffer slices instead of going through the stream one character at a time. The result is
+    // then copied exactly once more, into the `String` object.
+    get_line_buffer & buf = get_get_line_buffer();
+    ssize_t n = getline(&buf.m_data, &buf.m_capacity, fp);
+    obj_res ret;
+    if (n >= 0) {
+        // A final line without a line break sets the EOF marker; reset it so that later calls
+        // observe data appended in the meantime, as for all other reads.
+        if (std::feof(fp)) {
+            clearerr(fp);
+        }
+        ret = io_result_mk_ok(lean_mk_string_from_bytes(buf.m_data, n));
+    } else if (std::ferror(fp)) {
+        ret = io_result_mk_error(decode_io_error(errno, nullptr));
+    } else {
+        clearerr(fp);
+        ret = io_result_mk_ok(mk_string(""));
+    }
+    if (buf.m_capacity > g_get_line_buffer_max_retained) {
+        free(buf.m_data);
+        buf.m_data     = nullptr;
+        buf.m_capacity = 0;
+    }
+    return ret;
+#endif
 }
 
 /* Handle.putStr : (@& Handle) → (@& String) → IO Unit */
@@ -632,6 +673,138 @@ extern "C" LEAN_EXPORT obj_res lean_io_prim_handle_put_str(b_obj_arg h, b_obj_ar
     }
 }
 
+/*
+  Read-only file mappings. The contents are exposed as a persistent `ByteArray` (reference
+  counter 0, so it is never mutated in place nor freed by reference counting) whose header lives
+  directly in front of the file contents: on POSIX systems we reserve one extra page before the
+  file mapping and put the header at the end of that page. The view is valid as long as the
+  `MappedFile` object is alive; its finalizer unmaps both.
+
+  On Windows we cannot reliably place a mapping right behind a page we own, so the file is read
+  into a single heap block instead. This keeps the API uniform but does not save memory there.
+*/
+struct io_mapped_file {
+    char *        m_base;    // start of the region, including the header page
+    size_t        m_length;  // total length of the region
+    lean_object * m_view;    // persistent `ByteArray` header directly preceding the contents
+};
+
+static lean_external_class * g_io_mapped_file_external_class = nullptr;
+
+static void io_mapped_file_finalizer(void * p) {
+    io_mapped_file * m = static_cast<io_mapped_file *>(p);
+#ifdef LEAN_WINDOWS
+    free(m->m_base);
+#else
+    munmap(m->m_base, m->m_length);
+#endif
+    delete m;
+}
+
+static void io_mapped_file_foreach(void * /* mod */, b_obj_arg /* fn */) {
+}
+
+static io_mapped_file * io_get_mapped_file(b_obj_arg m) {
+    return static_cast<io_mapped_file *>(lean_get_external_data(m));
+}
+
+static lean_object * init_mapped_file_view(char * data, size_t size) {
+    lean_object * view = reinterpret_cast<lean_object *>(data - sizeof(lean_sarray_object));
+    lean_set_non_heap_header_for_big(view, LeanScalarArray, 1);
+    lean_to_sarray(view)->m_size     = size;
+    lean_to_sarray(view)->m_capacity = size;
+    return view;
+}
+
+/* MappedFile.mk (fname : @& FilePath) : IO MappedFile */
+extern "C" LEAN_EXPORT obj_res lean_io_mmap(b_obj_arg fname, obj_arg /* w */) {
+    io_mapped_file * m = new io_mapped_file;
+#ifdef LEAN_WINDOWS
+    FILE * fp = fopen(string_cstr(fname), "rb");
+    if (!fp) {
+        delete m;
+        return io_result_mk_error(decode_io_error(errno, fname));
+    }
+    struct _stat64 st;
+    if (_fstat64(_fileno(fp), &st) != 0) {
+        int err = errno;
+        fclose(fp);
+        delete m;
+        return io_result_mk_error(decode_io_error(err, fname));
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    m->m_length = sizeof(lean_sarray_object) + size;
+    m->m_base   = static_cast<char *>(malloc(m->m_length));
+    if (!m->m_base || std::fread(m->m_base + sizeof(lean_sarray_object), 1, size, fp) != size) {
+        fclose(fp);
+        free(m->m_base);
+        delete m;
+        return io_result_mk_error(decode_io_error(EIO, fname));
+    }
+    fclose(fp);
+    m->m_view = init_mapped_file_view(m->m_base + sizeof(lean_sarray_object), size);
+#else
+    int fd = open(string_cstr(fname), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        delete m;
+        return io_result_mk_error(decode_io_error(errno, fname));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        delete m;
+        return io_result_mk_error(decode_io_error(err, fname));
+    }
+    size_t size      = static_cast<size_t>(st.st_size);
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    m->m_length = page_size + (size + page_size - 1) / page_size * page_size;
+    void * base = mmap(nullptr, m->m_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        delete m;
+        return io_result_mk_error(decode_io_error(err, fname));
+    }
+    m->m_base = static_cast<char *>(base);
+    // An empty file cannot be mapped, but then there is nothing to map either.
+    if (size > 0 && mmap(m->m_base + page_size, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        munmap(m->m_base, m->m_length);
+        delete m;
+        return io_result_mk_error(decode_io_error(err, fname));
+    }
+    close(fd);
+    m->m_view = init_mapped_file_view(m->m_base + page_size, size);
+    mprotect(m->m_base, page_size, PROT_READ);
+#endif
+    return io_result_mk_ok(lean_alloc_external(g_io_mapped_file_external_class, m));
+}
+
+/* MappedFile.size (m : @& MappedFile) : USize */
+extern "C" LEAN_EXPORT usize lean_io_mmap_size(b_obj_arg m) {
+    return lean_sarray_size(io_get_mapped_file(m)->m_view);
+}
+
+/* MappedFile.extract (m : @& MappedFile) (start stop : USize) : BaseIO ByteArray */
+extern "C" LEAN_EXPORT obj_res lean_io_mmap_extract(b_obj_arg m, usize start, usize stop, obj_arg /* w */) {
+    lean_object * view = io_get_mapped_file(m)->m_view;
+    usize size = lean_sarray_size(view);
+    if (stop > size) stop = size;
+    if (start > stop) start = stop;
+    usize n = stop - start;
+    obj_res r = lean_alloc_sarray(1, n, n);
+    memcpy(lean_sarray_cptr(r), lean_sarray_cptr(view) + start, n);
+    return io_result_mk_ok(r);
+}
+
+/* MappedFile.withView (m : @& MappedFile) (f : ByteArray → IO α) : IO α */
+extern "C" LEAN_EXPORT obj_res lean_io_mmap_with_view(b_obj_arg m, obj_arg f, obj_arg w) {
+    // `m` is borrowed, so the caller keeps the mapping alive until `f` has returned.
+    return lean_apply_2(f, io_get_mapped_file(m)->m_view, w);
+}
+
 /* Std.Time.Timestamp.now : IO Timestamp */
 extern "C" LEAN_EXPORT obj_res lean_get_current_time(obj_arg /* w */) {
     using namespace std::chrono;
@@ -1532,6 +1705,7 @@ void initialize_io() {
     g_io_error_nullptr_read = lean_mk_io_user_error(mk_ascii_string_unchecked("null reference read"));
     mark_persistent(g_io_error_nullptr_read);
     g_io_handle_external_class = lean_register_external_class(io_handle_finalizer, io_handle_foreach);
+    g_io_mapped_file_external_class = lean_register_external_class(io_mapped_file_finalizer, io_mapped_file_foreach);
 #if defined(LEAN_WINDOWS)
     _setmode(_fileno(stdout), _O_BINARY);
     _setmode(_fileno(stderr), _O_BINARY);
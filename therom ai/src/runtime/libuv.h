@@ -11,6 +11,7 @@ Author: Markus Himmel, Sofia Rodrigues
 #include "runtime/uv/tcp.h"
 #include "runtime/uv/dns.h"
 #include "runtime/uv/udp.h"
+#include "runtime/uv/fs.h"
 #include "runtime/alloc.h"
 #include "runtime/io.h"
 #include "runtime/utf8.h"
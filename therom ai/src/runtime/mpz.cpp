@@ -114,6 +114,32 @@ size_t mpz::get_size_t() const {
     return static_cast<size_t>(mpz_getlimbn(m_val, 0));
 }
 
+#ifdef LEAN_HAS_INT128
+bool mpz::is_uint128() const {
+    // `mpz_sizeinbase` is exact for base 2 and returns 1 for zero.
+    return is_nonneg() && mpz_sizeinbase(m_val, 2) <= 128;
+}
+
+bool mpz::is_int128() const {
+    // Excludes -2^127, which is fine for a fast path.
+    return mpz_sizeinbase(m_val, 2) <= 127;
+}
+
+uint128 mpz::get_abs_uint128() const {
+    uint128 r = 0;
+    for (size_t i = mpz_size(m_val); i-- > 0;)
+        r = (r << GMP_NUMB_BITS) | static_cast<uint128>(mpz_getlimbn(m_val, i));
+    return r;
+}
+
+mpz mpz::of_uint128(uint128 v) {
+    mpz r;
+    uint64 words[2] = { static_cast<uint64>(v), static_cast<uint64>(v >> 64) };
+    mpz_import(r.m_val, 2, -1, sizeof(uint64), 0, 0, words);
+    return r;
+}
+#endif
+
 mpz & mpz::operator=(mpz const & v) {
     mpz_set(m_val, v.m_val); return *this;
 }
@@ -513,6 +539,36 @@ size_t mpz::get_size_t() const {
     }
 }
 
+#ifdef LEAN_HAS_INT128
+bool mpz::is_uint128() const {
+    return !m_sign && m_size * 8 * sizeof(mpn_digit) <= 128;
+}
+
+bool mpz::is_int128() const {
+    size_t max_size = 128 / (8 * sizeof(mpn_digit));
+    return m_size < max_size || (m_size == max_size && (m_digits[m_size - 1] >> (8 * sizeof(mpn_digit) - 1)) == 0);
+}
+
+uint128 mpz::get_abs_uint128() const {
+    uint128 r = 0;
+    for (size_t i = m_size; i-- > 0;)
+        r = (r << 8*sizeof(mpn_digit)) | static_cast<uint128>(m_digits[i]);
+    return r;
+}
+
+mpz mpz::of_uint128(uint128 v) {
+    size_t sz = 1;
+    while (sz * 8 * sizeof(mpn_digit) < 128 && (v >> (sz * 8 * sizeof(mpn_digit))) != 0)
+        sz++;
+    mpz r;
+    mpz_dealloc(r.m_digits, sizeof(mpn_digit)*r.m_size);
+    r.allocate(sz);
+    for (size_t i = 0; i < sz; i++)
+        r.m_digits[i] = static_cast<mpn_digit>(v >> (i * 8 * sizeof(mpn_digit)));
+    return r;
+}
+#endif
+
 mpz & mpz::operator=(mpz const & v) {
     if (v.m_digits != m_digits) {
         if (v.m_size == m_size) {
@@ -1069,6 +1125,27 @@ std::ostream & operator<<(std::ostream & out, mpz const & v) {
 #endif
 
 
+#ifdef LEAN_HAS_INT128
+uint128 mpz::get_uint128() const {
+    lean_assert(is_uint128());
+    return get_abs_uint128();
+}
+
+int128 mpz::get_int128() const {
+    lean_assert(is_int128());
+    int128 r = static_cast<int128>(get_abs_uint128());
+    return is_neg() ? -r : r;
+}
+
+mpz mpz::of_int128(int128 v) {
+    if (v >= 0)
+        return of_uint128(static_cast<uint128>(v));
+    mpz r = of_uint128(-static_cast<uint128>(v));
+    r.neg();
+    return r;
+}
+#endif
+
 std::string mpz::to_string() const {
     std::ostringstream out;
     out << *this;
@@ -45,6 +45,9 @@ class LEAN_EXPORT mpz {
     mpz & div(bool sign, size_t sz, mpn_digit const * digits);
     mpz & rem(size_t sz, mpn_digit const * digits);
 #endif
+#ifdef LEAN_HAS_INT128
+    uint128 get_abs_uint128() const;
+#endif
 public:
     mpz();
 #ifdef LEAN_USE_GMP
@@ -140,6 +143,15 @@ public:
     unsigned int get_unsigned_int() const;
     size_t get_size_t() const;
 
+#ifdef LEAN_HAS_INT128
+    bool is_uint128() const;
+    bool is_int128() const;
+    uint128 get_uint128() const;
+    int128 get_int128() const;
+    static mpz of_uint128(uint128 v);
+    static mpz of_int128(int128 v);
+#endif
+
     mpz & operator=(mpz const & v);
     mpz & operator=(mpz && v) { swap(*this, v); return *this; }
     mpz & operator=(char const * v);
@@ -1239,13 +1239,13 @@ void deactivate_promise(lean_promise_object * promise) {
 // =======================================
 // Natural numbers
 
-object * alloc_mpz(mpz const & m) {
+template<typename M> static inline object * alloc_mpz_core(M && m) {
     void * mem = lean_alloc_small_object(sizeof(mpz_object));
 #ifdef LEAN_MIMALLOC
     // placement new is not guaranteed to preserve this field so store and restore it
     unsigned sz = ((lean_object *)mem)->m_cs_sz;
 #endif
-    mpz_object * o = new (mem) mpz_object(m);
+    mpz_object * o = new (mem) mpz_object(std::forward<M>(m));
 #ifdef LEAN_MIMALLOC
     o->m_header.m_cs_sz = sz;
 #endif
@@ -1253,6 +1253,15 @@ object * alloc_mpz(mpz const & m) {
     return (lean_object*)o;
 }
 
+object * alloc_mpz(mpz const & m) {
+    return alloc_mpz_core(m);
+}
+
+/* Takes over the limbs of a temporary result instead of copying them. */
+object * alloc_mpz(mpz && m) {
+    return alloc_mpz_core(std::move(m));
+}
+
 #ifdef LEAN_USE_GMP
 extern "C" LEAN_EXPORT lean_object * lean_alloc_mpz(mpz_t v) {
     return alloc_mpz(mpz(v));
@@ -1268,6 +1277,11 @@ object * mpz_to_nat_core(mpz const & m) {
     return alloc_mpz(m);
 }
 
+object * mpz_to_nat_core(mpz && m) {
+    lean_assert(!m.is_size_t() || m.get_size_t() > LEAN_MAX_SMALL_NAT);
+    return alloc_mpz(std::move(m));
+}
+
 static inline obj_res mpz_to_nat(mpz const & m) {
     if (m.is_size_t() && m.get_size_t() <= LEAN_MAX_SMALL_NAT)
         return lean_box(m.get_size_t());
@@ -1275,6 +1289,43 @@ static inline obj_res mpz_to_nat(mpz const & m) {
         return mpz_to_nat_core(m);
 }
 
+static inline obj_res mpz_to_nat(mpz && m) {
+    if (m.is_size_t() && m.get_size_t() <= LEAN_MAX_SMALL_NAT)
+        return lean_box(m.get_size_t());
+    else
+        return alloc_mpz(std::move(m));
+}
+
+#ifdef LEAN_HAS_INT128
+/*
+  Fixed-width fast paths for the big-number primitives.
+
+  Most `Nat` values that overflow the boxed scalar range (hashes, `UInt64` arithmetic done in
+  `Nat`, bit-vector encodings, ...) still fit in 128 bits. For those we compute the result with
+  native 128-bit arithmetic and only materialize an `mpz` for the result, instead of converting
+  both operands and going through GMP. The object representation is unchanged: results are
+  still either boxed scalars or `mpz` objects.
+*/
+static inline bool nat_to_uint128(b_obj_arg a, uint128 & r) {
+    if (lean_is_scalar(a)) {
+        r = lean_unbox(a);
+        return true;
+    }
+    mpz const & m = mpz_value(a);
+    if (!m.is_uint128())
+        return false;
+    r = m.get_uint128();
+    return true;
+}
+
+static inline obj_res uint128_to_nat(uint128 v) {
+    if (v <= LEAN_MAX_SMALL_NAT)
+        return lean_box(static_cast<size_t>(v));
+    else
+        return alloc_mpz(mpz::of_uint128(v));
+}
+#endif
+
 extern "C" LEAN_EXPORT object * lean_cstr_to_nat(char const * n) {
     return mpz_to_nat(mpz(n));
 }
@@ -1301,6 +1352,11 @@ extern "C" LEAN_EXPORT object * lean_nat_big_succ(object * a) {
 
 extern "C" LEAN_EXPORT object * lean_nat_big_add(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && n1 + n2 >= n1)
+        return uint128_to_nat(n1 + n2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_nat_core(mpz::of_size_t(lean_unbox(a1)) + mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1311,6 +1367,11 @@ extern "C" LEAN_EXPORT object * lean_nat_big_add(object * a1, object * a2) {
 
 extern "C" LEAN_EXPORT object * lean_nat_big_sub(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+        return n1 < n2 ? lean_box(0) : uint128_to_nat(n1 - n2);
+#endif
     if (lean_is_scalar(a1)) {
         lean_assert(mpz::of_size_t(lean_unbox(a1)) < mpz_value(a2));
         return lean_box(0);
@@ -1327,6 +1388,13 @@ extern "C" LEAN_EXPORT object * lean_nat_big_sub(object * a1, object * a2) {
 
 extern "C" LEAN_EXPORT object * lean_nat_big_mul(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    // The product of two 64-bit values always fits. We avoid `__builtin_mul_overflow` on 128-bit
+    // operands since it requires compiler-rt helpers that are not available on every toolchain.
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && (n1 >> 64) == 0 && (n2 >> 64) == 0)
+        return uint128_to_nat(n1 * n2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_nat(mpz::of_size_t(lean_unbox(a1)) * mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1336,11 +1404,21 @@ extern "C" LEAN_EXPORT object * lean_nat_big_mul(object * a1, object * a2) {
 }
 
 extern "C" LEAN_EXPORT object * lean_nat_overflow_mul(size_t a1, size_t a2) {
+#ifdef LEAN_HAS_INT128
+    // The product of two machine words always fits.
+    return uint128_to_nat(static_cast<uint128>(a1) * static_cast<uint128>(a2));
+#else
     return mpz_to_nat(mpz::of_size_t(a1) * mpz::of_size_t(a2));
+#endif
 }
 
 extern "C" LEAN_EXPORT object * lean_nat_big_div(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && n2 != 0)
+        return uint128_to_nat(n1 / n2);
+#endif
     if (lean_is_scalar(a1)) {
         lean_assert(mpz_value(a2) != 0);
         lean_assert(mpz::of_size_t(lean_unbox(a1)) / mpz_value(a2) == 0);
@@ -1372,6 +1450,11 @@ extern "C" LEAN_EXPORT object * lean_nat_big_div_exact(object * a1, object * a2)
 
 extern "C" LEAN_EXPORT object * lean_nat_big_mod(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    if (!lean_is_scalar(a1) && nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && n2 != 0)
+        return uint128_to_nat(n1 % n2);
+#endif
     if (lean_is_scalar(a1)) {
         lean_assert(mpz_value(a2) != 0);
         return a1;
@@ -1427,6 +1510,11 @@ extern "C" LEAN_EXPORT bool lean_nat_big_lt(object * a1, object * a2) {
 
 extern "C" LEAN_EXPORT object * lean_nat_big_land(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+        return uint128_to_nat(n1 & n2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_nat(mpz::of_size_t(lean_unbox(a1)) & mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1437,6 +1525,11 @@ extern "C" LEAN_EXPORT object * lean_nat_big_land(object * a1, object * a2) {
 
 extern "C" LEAN_EXPORT object * lean_nat_big_lor(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+        return uint128_to_nat(n1 | n2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_nat(mpz::of_size_t(lean_unbox(a1)) | mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1447,6 +1540,11 @@ extern "C" LEAN_EXPORT object * lean_nat_big_lor(object * a1, object * a2) {
 
 extern "C" LEAN_EXPORT object * lean_nat_big_xor(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_HAS_INT128
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+        return uint128_to_nat(n1 ^ n2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_nat(mpz::of_size_t(lean_unbox(a1)) ^ mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1546,6 +1644,35 @@ static object * mpz_to_int(mpz const & m) {
         return lean_box(static_cast<unsigned>(m.get_int()));
 }
 
+static object * mpz_to_int(mpz && m) {
+    if (m < LEAN_MIN_SMALL_INT || m > LEAN_MAX_SMALL_INT)
+        return alloc_mpz(std::move(m));
+    else
+        return lean_box(static_cast<unsigned>(m.get_int()));
+}
+
+#ifdef LEAN_HAS_INT128
+// See the fixed-width fast paths for `Nat` above.
+static inline bool int_to_int128(b_obj_arg a, int128 & r) {
+    if (lean_is_scalar(a)) {
+        r = lean_scalar_to_int64(a);
+        return true;
+    }
+    mpz const & m = mpz_value(a);
+    if (!m.is_int128())
+        return false;
+    r = m.get_int128();
+    return true;
+}
+
+static inline obj_res int128_to_int(int128 v) {
+    if (LEAN_MIN_SMALL_INT <= v && v <= LEAN_MAX_SMALL_INT)
+        return lean_box(static_cast<unsigned>(static_cast<int>(v)));
+    else
+        return alloc_mpz(mpz::of_int128(v));
+}
+#endif
+
 extern "C" LEAN_EXPORT lean_obj_res lean_big_int_to_nat(lean_obj_arg a) {
     lean_assert(!lean_is_scalar(a));
     mpz m = mpz_value(a);
@@ -1578,6 +1705,11 @@ extern "C" LEAN_EXPORT object * lean_int_big_neg(object * a) {
 }
 
 extern "C" LEAN_EXPORT object * lean_int_big_add(object * a1, object * a2) {
+#ifdef LEAN_HAS_INT128
+    int128 i1, i2, r;
+    if (int_to_int128(a1, i1) && int_to_int128(a2, i2) && !__builtin_add_overflow(i1, i2, &r))
+        return int128_to_int(r);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(lean_scalar_to_int(a1) + mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1587,6 +1719,11 @@ extern "C" LEAN_EXPORT object * lean_int_big_add(object * a1, object * a2) {
 }
 
 extern "C" LEAN_EXPORT object * lean_int_big_sub(object * a1, object * a2) {
+#ifdef LEAN_HAS_INT128
+    int128 i1, i2, r;
+    if (int_to_int128(a1, i1) && int_to_int128(a2, i2) && !__builtin_sub_overflow(i1, i2, &r))
+        return int128_to_int(r);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(lean_scalar_to_int(a1) - mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1596,6 +1733,12 @@ extern "C" LEAN_EXPORT object * lean_int_big_sub(object * a1, object * a2) {
 }
 
 extern "C" LEAN_EXPORT object * lean_int_big_mul(object * a1, object * a2) {
+#ifdef LEAN_HAS_INT128
+    int128 i1, i2;
+    // See `lean_nat_big_mul`.
+    if (int_to_int128(a1, i1) && int_to_int128(a2, i2) && i1 == static_cast<int64>(i1) && i2 == static_cast<int64>(i2))
+        return int128_to_int(i1 * i2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(lean_scalar_to_int(a1) * mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -9,6 +9,7 @@ Author: Jared Roesch
 #include <iostream>
 #include <iomanip>
 #include <utility>
+#include <vector>
 #include <system_error>
 
 #if defined(LEAN_WINDOWS)
@@ -25,6 +26,9 @@ Author: Jared Roesch
 #include <sys/wait.h>
 #include <signal.h>
 #include <limits.h> // NOLINT
+#if !defined(LEAN_EMSCRIPTEN)
+#include <spawn.h>
+#endif
 #endif
 
 #ifdef __linux
@@ -434,17 +438,49 @@ static optional<pipe> setup_stdio(stdio cfg) {
 extern "C" char **environ;
 #endif
 
-static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode, stdio stdout_mode,
-  stdio stderr_mode, option_ref<string_ref> const & cwd, array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env,
-  bool inherit_env, bool do_setsid) {
-    /* Setup stdio based on process configuration. */
-    auto stdin_pipe  = setup_stdio(stdin_mode);
-    auto stdout_pipe = setup_stdio(stdout_mode);
-    auto stderr_pipe = setup_stdio(stderr_mode);
+/*
+  `posix_spawn` starts the child without duplicating the page tables of the parent, which makes
+  spawning independent of the size of our heap; `fork` has to copy the page tables even though the
+  pages themselves are shared copy-on-write, which dominates the cost of spawning from a process
+  with a multi-GB heap. glibc implements it via `clone(CLONE_VM | CLONE_VFORK)`, macOS natively.
+
+  Changing the working directory of the child requires `posix_spawn_file_actions_addchdir_np`
+  (glibc 2.29, macOS 10.15). When it is not available, or when the child's `PATH` differs from ours
+  (`posix_spawnp` searches the parent's `PATH`), we fall back to `fork` + `execvp`.
+*/
+#if !defined(LEAN_EMSCRIPTEN) && defined(POSIX_SPAWN_SETSID)
+#define LEAN_POSIX_SPAWN
+#if defined(__APPLE__) || (defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29)))
+#define LEAN_POSIX_SPAWN_CHDIR
+#endif
+#endif
 
-    int pid = fork();
+static void close_pipe(optional<pipe> const & p) {
+    if (p) {
+        close(p->m_read_fd);
+        close(p->m_write_fd);
+    }
+}
+
+/* Report `errno` to the parent through `fd` and exit; used when the child fails before `exec`. */
+static void fail_child(int fd) {
+    int err = errno;
+    while (write(fd, &err, sizeof(err)) < 0 && errno == EINTR) {}
+    _exit(127);
+}
+
+/* Returns `0` and sets `pid` on success, and an `errno` value otherwise. Failures of the child to change its working
+   directory or to execute `proc_name` are reported through a close-on-exec pipe, so that they result in an error like
+   with `posix_spawn` rather than in a child exiting with an error code. */
+static int fork_child(pid_t & pid, string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode,
+  stdio stdout_mode, stdio stderr_mode, optional<pipe> const & stdin_pipe, optional<pipe> const & stdout_pipe,
+  optional<pipe> const & stderr_pipe, option_ref<string_ref> const & cwd,
+  array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env, bool inherit_env, bool do_setsid) {
+    pipe status = *setup_stdio(stdio::PIPED);
+    pid = fork();
 
     if (pid == 0) {
+        close(status.m_read_fd);
         if (!inherit_env) {
 #ifdef __APPLE__
             environ = NULL;
@@ -486,8 +522,7 @@ static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const &
 
         if (cwd) {
             if (chdir(cwd.get()->data()) < 0) {
-                std::cerr << "could not change directory to " << cwd.get()->data() << std::endl;
-                exit(-1);
+                fail_child(status.m_write_fd);
             }
         }
 
@@ -501,12 +536,148 @@ static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const &
             pargs.push_back(strdup(arg.data()));
         pargs.push_back(NULL);
 
-        if (execvp(pargs[0], pargs.data()) < 0) {
-            std::cerr << "could not execute external process '" << pargs[0] << "'" << std::endl;
-            exit(-1);
+        execvp(pargs[0], pargs.data());
+        fail_child(status.m_write_fd);
+    }
+    int err = 0;
+    if (pid == -1) {
+        err = errno;
+    } else {
+        close(status.m_write_fd);
+        status.m_write_fd = -1;
+        // blocks until the child has executed `proc_name` (closing the pipe) or failed
+        int child_err;
+        ssize_t n;
+        while ((n = read(status.m_read_fd, &child_err, sizeof(child_err))) < 0 && errno == EINTR) {}
+        if (n == sizeof(child_err)) {
+            err = child_err;
+            while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+        }
+    }
+    close(status.m_read_fd);
+    if (status.m_write_fd >= 0) close(status.m_write_fd);
+    return err;
+}
+
+#ifdef LEAN_POSIX_SPAWN
+static bool can_posix_spawn(option_ref<string_ref> const & cwd, array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env,
+  bool inherit_env) {
+#ifndef LEAN_POSIX_SPAWN_CHDIR
+    if (cwd) return false;
+#endif
+    if (!inherit_env) return false;
+    for (auto & entry : env) {
+        if (strcmp(entry.fst().data(), "PATH") == 0) return false;
+    }
+    return true;
+}
+
+static bool env_entry_has_name(char const * entry, string_ref const & name) {
+    size_t n = name.num_bytes();
+    return strncmp(entry, name.data(), n) == 0 && entry[n] == '=';
+}
+
+/* Returns `0` and sets `pid` on success, and an `errno` value otherwise. */
+static int posix_spawn_child(pid_t & pid, string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode,
+  stdio stdout_mode, stdio stderr_mode, optional<pipe> const & stdin_pipe, optional<pipe> const & stdout_pipe,
+  optional<pipe> const & stderr_pipe, option_ref<string_ref> const & cwd,
+  array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env, bool do_setsid) {
+    // Everything the child needs is prepared here; the child itself only applies the file actions.
+    // The entries of `env` are applied in order, like the `setenv`/`unsetenv` calls of `fork_child`: the last entry
+    // of a variable wins, and `none` removes the variable.
+    std::vector<std::string> env_strs;
+    for (char ** e = environ; *e; e++)
+        env_strs.push_back(*e);
+    for (auto & entry : env) {
+        for (auto it = env_strs.begin(); it != env_strs.end();) {
+            if (env_entry_has_name(it->c_str(), entry.fst()))
+                it = env_strs.erase(it);
+            else
+                it++;
         }
-    } else if (pid == -1) {
-        throw errno;
+        if (entry.snd()) {
+            env_strs.push_back(entry.fst().to_std_string() + "=" + entry.snd().get()->to_std_string());
+        }
+    }
+    buffer<char *> penv;
+    for (auto & e : env_strs)
+        penv.push_back(const_cast<char *>(e.c_str()));
+    penv.push_back(NULL);
+
+    buffer<char *> pargs;
+    pargs.push_back(const_cast<char *>(proc_name.data()));
+    for (auto & arg : args)
+        pargs.push_back(const_cast<char *>(arg.data()));
+    pargs.push_back(NULL);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    if (int err = posix_spawn_file_actions_init(&actions)) return err;
+    if (int err = posix_spawnattr_init(&attr)) {
+        posix_spawn_file_actions_destroy(&actions);
+        return err;
+    }
+    // The other ends of the pipes are `O_CLOEXEC` and thus closed by the `exec`.
+    int err = 0;
+    if (stdin_pipe) {
+        err = posix_spawn_file_actions_adddup2(&actions, stdin_pipe->m_read_fd, STDIN_FILENO);
+    } else if (stdin_mode == stdio::NUL) {
+        err = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    if (!err && stdout_pipe) {
+        err = posix_spawn_file_actions_adddup2(&actions, stdout_pipe->m_write_fd, STDOUT_FILENO);
+    } else if (!err && stdout_mode == stdio::NUL) {
+        err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    if (!err && stderr_pipe) {
+        err = posix_spawn_file_actions_adddup2(&actions, stderr_pipe->m_write_fd, STDERR_FILENO);
+    } else if (!err && stderr_mode == stdio::NUL) {
+        err = posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+#ifdef LEAN_POSIX_SPAWN_CHDIR
+    if (!err && cwd) {
+        err = posix_spawn_file_actions_addchdir_np(&actions, cwd.get()->data());
+    }
+#else
+    lean_assert(!cwd);
+#endif
+    if (!err && do_setsid) {
+        err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+    }
+    if (!err) {
+        err = posix_spawnp(&pid, pargs[0], &actions, &attr, pargs.data(), penv.data());
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return err;
+}
+#endif
+
+static obj_res spawn(string_ref const & proc_name, array_ref<string_ref> const & args, stdio stdin_mode, stdio stdout_mode,
+  stdio stderr_mode, option_ref<string_ref> const & cwd, array_ref<pair_ref<string_ref, option_ref<string_ref>>> const & env,
+  bool inherit_env, bool do_setsid) {
+    /* Setup stdio based on process configuration. */
+    auto stdin_pipe  = setup_stdio(stdin_mode);
+    auto stdout_pipe = setup_stdio(stdout_mode);
+    auto stderr_pipe = setup_stdio(stderr_mode);
+
+    pid_t pid;
+    int err;
+#ifdef LEAN_POSIX_SPAWN
+    if (can_posix_spawn(cwd, env, inherit_env)) {
+        err = posix_spawn_child(pid, proc_name, args, stdin_mode, stdout_mode, stderr_mode,
+                                stdin_pipe, stdout_pipe, stderr_pipe, cwd, env, do_setsid);
+    } else
+#endif
+    {
+        err = fork_child(pid, proc_name, args, stdin_mode, stdout_mode, stderr_mode, stdin_pipe, stdout_pipe, stderr_pipe,
+                         cwd, env, inherit_env, do_setsid);
+    }
+    if (err) {
+        close_pipe(stdin_pipe);
+        close_pipe(stdout_pipe);
+        close_pipe(stderr_pipe);
+        return lean_io_result_mk_error(decode_io_error(err, proc_name.raw()));
     }
 
     object * parent_stdin  = box(0);
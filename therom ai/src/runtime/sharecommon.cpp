@@ -39,7 +39,7 @@ extern "C" LEAN_EXPORT uint64_t lean_sharecommon_hash(b_obj_arg o) {
         return hash(tag, mpz_value(o).hash());
     } else {
         // hash relevant parts of the header
-        unsigned init = hash(tag, lean_ptr_other(o));
+        uint64 init = hash(tag, lean_ptr_other(o));
         // hash body
         return hash_str(sz - header_sz, reinterpret_cast<unsigned char const *>(o) + header_sz, init);
     }
@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2025 theorem_ai FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include "runtime/uv/fs.h"
+#include <cstdio>
+
+namespace theorem_ai {
+#ifndef LEAN_EMSCRIPTEN
+
+using namespace std;
+
+/*
+  Positional reads and writes on `IO.FS.Handle`s that complete through the global event loop
+  instead of blocking the calling thread. On Linux, LibUV submits these requests through
+  io_uring when the running kernel supports it and transparently falls back to its own
+  blocking thread pool otherwise (`UV_USE_IO_URING=0` forces the fallback).
+
+  The requests address the underlying file descriptor directly and thus bypass the stdio
+  buffer of the handle: they neither observe nor move the handle's current position.
+*/
+
+static int fs_handle_fd(b_obj_arg h) {
+    FILE * fp = static_cast<FILE *>(lean_get_external_data(h));
+#ifdef LEAN_WINDOWS
+    return _fileno(fp);
+#else
+    return fileno(fp);
+#endif
+}
+
+static lean_uv_fs_req_t * fs_req_new(b_obj_arg h, lean_object * promise, lean_object * byte_array) {
+    lean_uv_fs_req_t * req = (lean_uv_fs_req_t*)malloc(sizeof(lean_uv_fs_req_t));
+    req->promise = promise;
+    req->handle = h;
+    req->byte_array = byte_array;
+    req->req.data = req;
+
+    // The request is completed on the event loop thread.
+    lean_mark_mt(h);
+    lean_inc(h);
+    lean_inc(promise);
+    return req;
+}
+
+static void fs_req_free(lean_uv_fs_req_t * req) {
+    uv_fs_req_cleanup(&req->req);
+    lean_dec(req->handle);
+    lean_dec(req->promise);
+    free(req);
+}
+
+// Std.Internal.UV.File.read (h : @& IO.FS.Handle) (offset : UInt64) (nbytes : USize) : IO (IO.Promise (Except IO.Error ByteArray))
+extern "C" LEAN_EXPORT lean_obj_res lean_uv_fs_read(b_obj_arg h, uint64_t offset, size_t nbytes, obj_arg /* w */) {
+    lean_object * promise = lean_promise_new();
+    mark_mt(promise);
+
+    lean_object * byte_array = lean_alloc_sarray(1, 0, nbytes);
+    lean_uv_fs_req_t * req = fs_req_new(h, promise, byte_array);
+    uv_buf_t buf = uv_buf_init((char*)lean_sarray_cptr(byte_array), nbytes);
+
+    event_loop_lock(&global_ev);
+
+    int result = uv_fs_read(global_ev.loop, &req->req, fs_handle_fd(h), &buf, 1, (int64_t)offset, [](uv_fs_t * uv_req) {
+        lean_uv_fs_req_t * req = (lean_uv_fs_req_t*)uv_req->data;
+        ssize_t n = uv_req->result;
+
+        if (n < 0) {
+            lean_dec(req->byte_array);
+            lean_promise_resolve(mk_except_err(lean_decode_uv_error(n, nullptr)), req->promise);
+        } else {
+            // A short read (including zero bytes at EOF) is not an error, as for `Handle.read`.
+            lean_sarray_set_size(req->byte_array, n);
+            lean_promise_resolve(mk_except_ok(req->byte_array), req->promise);
+        }
+
+        fs_req_free(req);
+    });
+
+    event_loop_unlock(&global_ev);
+
+    if (result < 0) {
+        lean_dec(byte_array);
+        lean_dec(promise); // We are not going to return it.
+        fs_req_free(req);
+
+        return lean_io_result_mk_error(lean_decode_uv_error(result, nullptr));
+    }
+
+    return lean_io_result_mk_ok(promise);
+}
+
+// Std.Internal.UV.File.write (h : @& IO.FS.Handle) (offset : UInt64) (buf : @& ByteArray) : IO (IO.Promise (Except IO.Error Unit))
+extern "C" LEAN_EXPORT lean_obj_res lean_uv_fs_write(b_obj_arg h, uint64_t offset, b_obj_arg data, obj_arg /* w */) {
+    // Data previously written through the stdio buffer must reach the file before ours does.
+    if (std::fflush(static_cast<FILE *>(lean_get_external_data(h))) != 0) {
+        return lean_io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+
+    lean_object * promise = lean_promise_new();
+    mark_mt(promise);
+
+    // The buffer is only read, so sharing it with the event loop thread is fine.
+    lean_mark_mt(data);
+    lean_inc(data);
+    lean_uv_fs_req_t * req = fs_req_new(h, promise, data);
+    uv_buf_t buf = uv_buf_init((char*)lean_sarray_cptr(data), lean_sarray_size(data));
+
+    event_loop_lock(&global_ev);
+
+    int result = uv_fs_write(global_ev.loop, &req->req, fs_handle_fd(h), &buf, 1, (int64_t)offset, [](uv_fs_t * uv_req) {
+        lean_uv_fs_req_t * req = (lean_uv_fs_req_t*)uv_req->data;
+        ssize_t n = uv_req->result;
+        size_t expected = lean_sarray_size(req->byte_array);
+
+        if (n < 0) {
+            lean_promise_resolve(mk_except_err(lean_decode_uv_error(n, nullptr)), req->promise);
+        } else if ((size_t)n != expected) {
+            lean_promise_resolve(mk_except_err(lean_decode_io_error(EIO, nullptr)), req->promise);
+        } else {
+            lean_promise_resolve(mk_except_ok(lean_box(0)), req->promise);
+        }
+
+        lean_dec(req->byte_array);
+        fs_req_free(req);
+    });
+
+    event_loop_unlock(&global_ev);
+
+    if (result < 0) {
+        lean_dec(data);
+        lean_dec(promise); // We are not going to return it.
+        fs_req_free(req);
+
+        return lean_io_result_mk_error(lean_decode_uv_error(result, nullptr));
+    }
+
+    return lean_io_result_mk_ok(promise);
+}
+
+#else
+
+// Std.Internal.UV.File.read (h : @& IO.FS.Handle) (offset : UInt64) (nbytes : USize) : IO (IO.Promise (Except IO.Error ByteArray))
+extern "C" LEAN_EXPORT lean_obj_res lean_uv_fs_read(b_obj_arg h, uint64_t offset, size_t nbytes, obj_arg /* w */) {
+    lean_always_assert(
+        false && ("Please build a version of theorem_ai4 with libuv to invoke this.")
+    );
+}
+
+// Std.Internal.UV.File.write (h : @& IO.FS.Handle) (offset : UInt64) (buf : @& ByteArray) : IO (IO.Promise (Except IO.Error Unit))
+extern "C" LEAN_EXPORT lean_obj_res lean_uv_fs_write(b_obj_arg h, uint64_t offset, b_obj_arg buf, obj_arg /* w */) {
+    lean_always_assert(
+        false && ("Please build a version of theorem_ai4 with libuv to invoke this.")
+    );
+}
+
+#endif
+}
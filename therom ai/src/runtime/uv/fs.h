@@ -0,0 +1,33 @@
+/*
+Copyright (c) 2025 theorem_ai FRO, LLC. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <theorem_ai/TheoremAI.h>
+#include "runtime/uv/event_loop.h"
+
+#ifndef LEAN_EMSCRIPTEN
+#include <uv.h>
+#endif
+
+namespace theorem_ai {
+
+#ifndef LEAN_EMSCRIPTEN
+using namespace std;
+
+// Stores all the things needed for a single positional read or write on a file handle.
+typedef struct {
+    uv_fs_t       req;          // LibUV file system request.
+    lean_object * promise;      // The promise resolved on completion.
+    lean_object * handle;       // The `IO.FS.Handle` being accessed, kept alive while the request is in flight.
+    lean_object * byte_array;   // Destination buffer for reads, source buffer for writes.
+} lean_uv_fs_req_t;
+
+#endif
+
+// =======================================
+// File functions
+extern "C" LEAN_EXPORT lean_obj_res lean_uv_fs_read(b_obj_arg h, uint64_t offset, size_t nbytes, obj_arg /* w */);
+extern "C" LEAN_EXPORT lean_obj_res lean_uv_fs_write(b_obj_arg h, uint64_t offset, b_obj_arg buf, obj_arg /* w */);
+
+}
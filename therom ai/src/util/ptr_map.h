@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2025 theorem_ai FRO. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "runtime/object.h"
+#include "runtime/thread.h"
+#include "runtime/hash.h"
+#include "util/unit.h"
+
+namespace theorem_ai {
+/* Keys of `ptr_map`: objects, or objects paired with an offset (the number of binders a subterm is under). */
+template<typename Key> struct ptr_map_key;
+
+template<> struct ptr_map_key<lean_object *> {
+    static lean_object * empty() { return nullptr; }
+    static bool is_empty(lean_object * k) { return k == nullptr; }
+    static uint64 hash(lean_object * k) { return static_cast<uint64>(reinterpret_cast<size_t>(k) >> 3); }
+};
+
+template<> struct ptr_map_key<std::pair<lean_object *, unsigned>> {
+    static std::pair<lean_object *, unsigned> empty() { return std::pair<lean_object *, unsigned>(nullptr, 0); }
+    static bool is_empty(std::pair<lean_object *, unsigned> const & k) { return k.first == nullptr; }
+    static uint64 hash(std::pair<lean_object *, unsigned> const & k) {
+        return theorem_ai::hash(static_cast<uint64>(reinterpret_cast<size_t>(k.first) >> 3), k.second);
+    }
+};
+
+/*
+Hash map with open addressing (linear probing) for the caches of term traversals such as `replace` and
+`instantiate_mvars`. Unlike `std::unordered_map`, inserting does not allocate a node per entry, and lookups
+probe consecutive slots.
+
+Entries cannot be removed. Traversals create a map, fill it and discard it; to avoid allocating and growing
+a table on every call, a map returns its (emptied) table to a per-thread pool when it is destroyed, and the
+next map of the same type created on the thread reuses it. Only one table per type is kept, and only if it is
+not larger than `max_pooled_capacity`. */
+template<typename Key, typename T>
+class ptr_map {
+    typedef ptr_map_key<Key> key_traits;
+    struct slot {
+        Key m_key;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type m_value;
+        T & value() { return *reinterpret_cast<T *>(&m_value); }
+    };
+    struct table {
+        std::vector<slot>     m_slots;
+        std::vector<unsigned> m_used;  // indices of the occupied slots, for clearing
+        unsigned              m_shift; // `64 - log2(m_slots.size())`
+    };
+    static constexpr unsigned initial_capacity    = 64;
+    static constexpr unsigned max_pooled_capacity = 1u << 14;
+    table * m_table;
+
+    static table *& pooled_table() {
+        LEAN_THREAD_PTR(table, g_pooled_table);
+        return g_pooled_table;
+    }
+
+    static void finalize_pooled_table(void *) {
+        delete pooled_table();
+        pooled_table() = nullptr;
+    }
+
+    static void release(table * t) {
+        table *& pooled = pooled_table();
+        if (pooled == nullptr && t->m_slots.size() <= max_pooled_capacity) {
+            LEAN_THREAD_VALUE(bool, g_registered, false);
+            if (!g_registered) {
+                register_thread_finalizer(finalize_pooled_table, nullptr);
+                g_registered = true;
+            }
+            pooled = t;
+        } else {
+            delete t;
+        }
+    }
+
+    static void init(table & t, unsigned capacity) {
+        slot s = slot();
+        s.m_key = key_traits::empty();
+        t.m_slots.assign(capacity, s);
+        t.m_shift = 64;
+        while (capacity > 1) { capacity >>= 1; t.m_shift--; }
+    }
+
+    size_t index(Key const & k) const {
+        // Fibonacci hashing: the high bits of the product depend on all bits of the key
+        return static_cast<size_t>((key_traits::hash(k) * 0x9E3779B97F4A7C15ull) >> m_table->m_shift);
+    }
+
+    slot * find_slot(Key const & k) const {
+        size_t mask = m_table->m_slots.size() - 1;
+        for (size_t i = index(k);; i = (i + 1) & mask) {
+            slot & s = m_table->m_slots[i];
+            if (s.m_key == k || key_traits::is_empty(s.m_key))
+                return &s;
+        }
+    }
+
+    void grow() {
+        table * old = m_table;
+        m_table = new table();
+        init(*m_table, static_cast<unsigned>(old->m_slots.size()) * 2);
+        m_table->m_used.reserve(old->m_used.size() * 2);
+        for (unsigned i : old->m_used) {
+            slot & s = old->m_slots[i];
+            slot * n = find_slot(s.m_key);
+            n->m_key = s.m_key;
+            new (&n->m_value) T(std::move(s.value()));
+            s.value().~T();
+            m_table->m_used.push_back(static_cast<unsigned>(n - m_table->m_slots.data()));
+        }
+        delete old;
+    }
+
+public:
+    ptr_map() {
+        table *& pooled = pooled_table();
+        if (pooled) {
+            m_table = pooled;
+            pooled  = nullptr;
+        } else {
+            m_table = new table();
+            init(*m_table, initial_capacity);
+        }
+    }
+
+    ptr_map(ptr_map const &) = delete;
+    ptr_map & operator=(ptr_map const &) = delete;
+
+    ~ptr_map() {
+        clear();
+        release(m_table);
+    }
+
+    size_t size() const { return m_table->m_used.size(); }
+
+    /* Return the value of `k`, or `nullptr` if there is none. */
+    T * find(Key const & k) const {
+        slot * s = find_slot(k);
+        return key_traits::is_empty(s->m_key) ? nullptr : &s->value();
+    }
+
+    /* Map `k` to `v` unless `k` is already in the map. Return true iff `k` was inserted. */
+    template<typename V> bool insert(Key const & k, V && v) {
+        slot * s = find_slot(k);
+        if (!key_traits::is_empty(s->m_key))
+            return false;
+        if (2 * (size() + 1) > m_table->m_slots.size()) {
+            grow();
+            s = find_slot(k);
+        }
+        s->m_key = k;
+        new (&s->m_value) T(std::forward<V>(v));
+        m_table->m_used.push_back(static_cast<unsigned>(s - m_table->m_slots.data()));
+        return true;
+    }
+
+    /* Remove all entries, keeping the table. */
+    void clear() {
+        for (unsigned i : m_table->m_used) {
+            slot & s = m_table->m_slots[i];
+            s.value().~T();
+            s.m_key = key_traits::empty();
+        }
+        m_table->m_used.clear();
+    }
+};
+
+/* Set of (object) pointers, see `ptr_map`. */
+template<typename Key>
+class ptr_set {
+    ptr_map<Key, unit> m_map;
+public:
+    bool contains(Key const & k) const { return m_map.find(k) != nullptr; }
+    /* Insert `k`, and return true iff it was not in the set yet. */
+    bool insert(Key const & k) { return m_map.insert(k, unit()); }
+    size_t size() const { return m_map.size(); }
+    void clear() { m_map.clear(); }
+};
+}
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Per-pass compile-time benchmark for the code generator.
+
+Compiles a fixed corpus with `-Dcompiler.pass_stats` and sums the wall time,
+allocations and code size recorded for each pass (see `compiler.pass_stats` in
+`src/library/compiler/compiler.cpp`). Run it in this folder with `theorem_ai`
+on the PATH:
+
+    ./compiler_passes.py --out base.json
+    ./compiler_passes.py --baseline base.json
+
+With `--baseline`, passes that got slower, allocate more, or produce bigger code
+than the given threshold are reported and the script exits with status 1.
+"""
+
+import argparse
+import collections
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+CORPUS = [
+    "binarytrees.theorem_ai",
+    "const_fold.theorem_ai",
+    "deriv.theorem_ai",
+    "liasolver.theorem_ai",
+    "mutual_codegen.theorem_ai",
+    "nested_match_codegen.theorem_ai",
+    "parser.theorem_ai",
+    "qsort.theorem_ai",
+    "rbmap.theorem_ai",
+    "unionfind.theorem_ai",
+]
+
+METRICS = ["time_ms", "allocs", "size_before", "size_after"]
+
+
+def run_corpus(lean, files):
+    """Return the per-pass totals, taking the fastest of the runs for the wall time."""
+    with tempfile.TemporaryDirectory() as tmp:
+        out = os.path.join(tmp, "stats.jsonl")
+        for f in files:
+            subprocess.run([lean, f"-Dcompiler.pass_stats={out}", f], check=True,
+                           stdout=subprocess.DEVNULL)
+        totals = collections.defaultdict(lambda: collections.Counter())
+        if not os.path.exists(out):
+            return {}
+        with open(out) as stats:
+            for line in stats:
+                for p in json.loads(line)["passes"]:
+                    t = totals[p["pass"]]
+                    t["calls"] += 1
+                    for m in METRICS:
+                        t[m] += p[m]
+        return {p: dict(t) for p, t in totals.items()}
+
+
+def merge_runs(runs):
+    r = runs[0]
+    for run in runs[1:]:
+        for p, t in run.items():
+            if p in r:
+                r[p]["time_ms"] = min(r[p]["time_ms"], t["time_ms"])
+    return r
+
+
+def display(totals):
+    print(f"{'pass':<26}{'calls':>8}{'time (ms)':>12}{'allocs':>14}{'size before':>14}{'size after':>14}")
+    for p, t in sorted(totals.items(), key=lambda pt: -pt[1]["time_ms"]):
+        print(f"{p:<26}{t['calls']:>8}{t['time_ms']:>12.1f}{t['allocs']:>14}{t['size_before']:>14}{t['size_after']:>14}")
+
+
+def compare(base, new, threshold):
+    regressions = []
+    for p, t in sorted(new.items()):
+        if p not in base:
+            continue
+        for m in ["time_ms", "allocs", "size_after"]:
+            old = base[p][m]
+            if old > 0 and t[m] > old * (1 + threshold):
+                regressions.append(f"{p}: {m} {old:g} -> {t[m]:g} (+{100 * (t[m] / old - 1):.1f}%)")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("files", nargs="*", default=CORPUS, help="files to compile (default: fixed corpus)")
+    parser.add_argument("--theorem_ai", default="theorem_ai", help="theorem_ai executable")
+    parser.add_argument("--runs", type=int, default=3, help="number of runs, the fastest time is kept")
+    parser.add_argument("--out", help="save the per-pass totals to this file")
+    parser.add_argument("--baseline", help="compare against totals saved with --out")
+    parser.add_argument("--threshold", type=float, default=0.1, help="relative increase reported as regression")
+    args = parser.parse_args()
+
+    totals = merge_runs([run_corpus(args.theorem_ai, args.files) for _ in range(max(args.runs, 1))])
+    display(totals)
+    if args.out:
+        with open(args.out, "w") as out:
+            json.dump(totals, out, indent=2, sort_keys=True)
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(json.load(f), totals, args.threshold)
+        for r in regressions:
+            print(f"regression: {r}")
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
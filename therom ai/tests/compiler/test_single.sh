@@ -13,6 +13,8 @@ if lean_has_llvm_support; then
     echo "running LLVM program..."
     rm "./$f.out" || true
     compile_lean_llvm_backend
+    # modules with many declarations are emitted in chunks, whose temporary bitcode files must be gone
+    ! ls "$f.linked.bc".*.bc 2>/dev/null || fail "Temporary bitcode files of $f were not removed"
     exec_check "./$f.out"
     diff_produced
 fi